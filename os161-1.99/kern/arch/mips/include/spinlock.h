@@ -31,6 +31,7 @@
 #define _MIPS_SPINLOCK_H_
 
 #include <cdefs.h>
+#include "opt-ticketlock.h"
 
 
 /* Type of value needed to actually spin on */
@@ -44,6 +45,26 @@ void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
 
+#if OPT_TICKETLOCK
+/*
+ * Ticket locks. The lock word holds two 16-bit counters: the next
+ * ticket to hand out in the upper half, and the ticket now being
+ * served in the lower half. The lock is free when they're equal.
+ *
+ * taketicket	Atomically take the next ticket; returns it.
+ * serving	The ticket now being served.
+ * nextticket	Atomically move on to serving the next ticket.
+ * isheld	True if someone holds or is waiting for the lock.
+ */
+#define SPINLOCK_TICKET_SHIFT	16
+#define SPINLOCK_TICKET_MASK	((1U << SPINLOCK_TICKET_SHIFT) - 1)
+
+unsigned spinlock_data_taketicket(volatile spinlock_data_t *sd);
+unsigned spinlock_data_serving(volatile spinlock_data_t *sd);
+void spinlock_data_nextticket(volatile spinlock_data_t *sd);
+bool spinlock_data_isheld(volatile spinlock_data_t *sd);
+#endif
+
 ////////////////////////////////////////////////////////////
 
 SPINLOCK_INLINE
@@ -93,5 +114,87 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+#if OPT_TICKETLOCK
+
+SPINLOCK_INLINE
+unsigned
+spinlock_data_taketicket(volatile spinlock_data_t *sd)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Fetch-and-add using LL/SC: add one to the next-ticket
+	 * counter, retrying until the SC succeeds. Overflow out of
+	 * the top of the word is harmless.
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *sd */
+			"addu %1, %0, %3;"	/*   y = x + inc */
+			"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (sd), "r" (1U << SPINLOCK_TICKET_SHIFT)
+			: "memory");
+	} while (y == 0);
+	return x >> SPINLOCK_TICKET_SHIFT;
+}
+
+SPINLOCK_INLINE
+unsigned
+spinlock_data_serving(volatile spinlock_data_t *sd)
+{
+	return *sd & SPINLOCK_TICKET_MASK;
+}
+
+SPINLOCK_INLINE
+void
+spinlock_data_nextticket(volatile spinlock_data_t *sd)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Only the holder changes the lower half, but other cpus may
+	 * be taking tickets in the upper half at the same time, so
+	 * this has to be atomic too. The lower half wraps around
+	 * without carrying into the upper half. (The mask goes in an
+	 * andi, so the assembler rejects it if it outgrows 16 bits.)
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *sd */
+			"addiu %1, %0, 1;"	/*   y = x + 1 */
+			"andi %1, %1, %3;"	/*   y &= MASK */
+			"srl %0, %0, %4;"	/*   x = (x >> SHIFT) << SHIFT */
+			"sll %0, %0, %4;"
+			"or %1, %1, %0;"	/*   y |= x */
+			"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (sd), "i" (SPINLOCK_TICKET_MASK),
+			  "i" (SPINLOCK_TICKET_SHIFT)
+			: "memory");
+	} while (y == 0);
+}
+
+SPINLOCK_INLINE
+bool
+spinlock_data_isheld(volatile spinlock_data_t *sd)
+{
+	spinlock_data_t x = *sd;
+
+	return (x >> SPINLOCK_TICKET_SHIFT) != (x & SPINLOCK_TICKET_MASK);
+}
+
+#endif /* OPT_TICKETLOCK */
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
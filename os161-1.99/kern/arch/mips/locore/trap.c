@@ -118,6 +118,9 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr) {
     (void)epc;
     (void)vaddr;
 
+    /* take down any other threads first */
+    uthread_exitall();
+
     /* proc.c 341 */
     struct addrspace *as;
     struct proc *p = curproc;
@@ -150,6 +153,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr) {
     }
     // take this look
     lock_acquire(procinfolist_lock);
+    rwlock_acquire_write(procinfolist_rwlock);
     struct procinfo *pi = procinfoarray_get_by_pid(procinfolist, p->pid); // curr process procinfo
     pid_t pid = pi->pid;
     pid_t ppid = pi->ppid;
@@ -157,6 +161,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr) {
           // I can exit right now
           pi->state = EXITED;
           procinfoarray_remove_by_pid(procinfolist, pid); // remove curr pid from procinfoarrary
+          procinfo_retire(pi);
       } else {
           struct procinfo *pp = procinfoarray_get_by_pid(procinfolist, ppid); // parent proc info
           if (!pp || RUNNING == pp->state) { // if parent 的procinfo是empty or state有错
@@ -165,6 +170,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr) {
           } else {
           	pi->state = EXITED;
           	procinfoarray_remove_by_pid(procinfolist, pid);
+          	procinfo_retire(pi);
           }
       }
       // cleanup zombine
@@ -175,9 +181,12 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr) {
       	if (pi->ppid == pid) {
       		pi->state = EXITED;
       		procinfoarray_remove(procinfolist, i);
+      		procinfo_retire(pi);
 
       	}
       }
+      procinfo_publish();
+      rwlock_release_write(procinfolist_rwlock);
       lock_release(procinfolist_lock);
       thread_exit();
       panic("return from thread_exit in kill_curthread()\n");
@@ -267,6 +276,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If we interrupted a thread in user mode whose process
+		 * is exiting, it should exit now rather than go back.
+		 * Sync up the interrupt state first, as below.
+		 */
+		if (!iskern && curproc != NULL && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			uthread_checkexit();
+		}
 		goto done2;
 	}
 
@@ -387,6 +407,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* Threads of an exiting process don't go back to user mode. */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -502,3 +527,27 @@ enter_new_process(int argc, userptr_t argv, vaddr_t stack, vaddr_t entry)
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a new thread of an existing
+ * process, calling entry(arg) on the given stack. If the function
+ * returns, the user-level code it returns into must call thread_exit
+ * (libc arranges this). $gp is the creating thread's, since crt0
+ * only loads it in the first thread and gp-relative small data
+ * accesses need it.
+ */
+void
+enter_new_thread(userptr_t arg, vaddr_t stack, vaddr_t entry, vaddr_t gp)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = (vaddr_t)arg;
+	tf.tf_sp = stack;
+	tf.tf_gp = gp;
+
+	mips_usermode(&tf);
+}
@@ -108,6 +108,27 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity((uint32_t)tf->tf_a0);
+		break;
+
+	    case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
+	    case SYS_settickets:
+		err = sys_settickets((int)tf->tf_a0);
+		break;
+
+	    case SYS_getrusage:
+		err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
 #ifdef UW
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
@@ -129,6 +150,24 @@ syscall(struct trapframe *tf)
 			    (int)tf->tf_a2,
 			    (pid_t *)&retval);
 	  break;
+	case SYS___thread_create:
+	  err = sys___thread_create((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1,
+				    (userptr_t)tf->tf_a2,
+				    tf->tf_gp,
+				    (int *)&retval);
+	  break;
+	case SYS_thread_exit:
+	  sys_thread_exit((int)tf->tf_a0);
+	  panic("unexpected return from sys_thread_exit");
+	  break;
+	case SYS_thread_join:
+	  err = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+	  break;
+	case SYS_futex:
+	  err = sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			  (int)tf->tf_a2, (int *)&retval);
+	  break;
 #endif // UW
 
 	    /* Add stuff here */
@@ -242,6 +242,24 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Stop and restart the on-chip timer. Writing c0_compare also resets
+ * c0_count, so "stopping" it amounts to pushing the next interrupt
+ * as far out as it will go (about 170 seconds at 25 MHz), and
+ * restarting it begins a fresh tick.
+ */
+void
+mainbus_hardclock_stop(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_hardclock_start(void)
+{
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Interrupt dispatcher.
  */
@@ -169,6 +169,26 @@ getch_intr(struct con_softc *cs)
 	return ret;
 }
 
+/*
+ * getch_intr for reads on behalf of user programs, which can wait
+ * forever: gives up with EINTR if the process starts exiting.
+ */
+static
+int
+getch_user(struct con_softc *cs, char *ch)
+{
+	int result;
+
+	result = P_intr(cs->cs_rsem);
+	if (result) {
+		return result;
+	}
+	*ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+	cs->cs_gotchars_tail =
+		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	return 0;
+}
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -275,6 +295,24 @@ getch(void)
 	return getch_intr(cs);
 }
 
+/*
+ * Wake up anyone waiting for console input so threads of an exiting
+ * process can give up. Called by uthread_exitall after setting
+ * p_exiting.
+ *
+ * This doesn't help threads waiting for con_userlock_read behind a
+ * reader from another process; they wait until that read finishes.
+ */
+void
+con_interrupt(void)
+{
+	struct con_softc *cs = the_console;
+
+	if (cs != NULL) {
+		sem_interrupt(cs->cs_rsem);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -320,7 +358,12 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			KASSERT(the_console != NULL);
+			result = getch_user(the_console, &ch);
+			if (result) {
+				lock_release(lk);
+				return result;
+			}
 			if (ch=='\r') {
 				ch = '\n';
 			}
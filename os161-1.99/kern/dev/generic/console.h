@@ -66,5 +66,6 @@ void con_start(/*struct con_softc*/ void *cs);
  *
  * putch/getch - see <lib.h>
  */
+void con_interrupt(void);
 
 #endif /* _GENERIC_CONSOLE_H_ */
@@ -62,6 +62,15 @@ config_rtclock(struct rtclock_softc *rtc, int unit)
 	return 0;
 }
 
+/*
+ * Return true once there is a clock, i.e. once gettime() will work.
+ */
+bool
+gettime_available(void)
+{
+	return the_clock != NULL;
+}
+
 void
 gettime(time_t *secs, uint32_t *nsecs)
 {
@@ -48,6 +48,9 @@
 
 static bool havetimerclock;
 
+/* The timer that drives timerclock(), if any. */
+static struct ltimer_softc *timerclock_lt;
+
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -87,10 +90,14 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	if (!havetimerclock) {
 		havetimerclock = true;
 		lt->lt_timerclock = 1;
+		timerclock_lt = lt;
 
-		/* Wire it to go off once every 10 ms */
-		/* KMS: reduced this from 1s to 10ms */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
+		/*
+		 * Run it as a one-shot; timerclock() reprograms it each
+		 * time, for the next tick (LT_GRANULARITY usec) or the
+		 * next timer deadline, whichever is sooner.
+		 */
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 0);
 		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
 				   LT_GRANULARITY);
 	}
@@ -125,6 +132,22 @@ ltimer_irq(void *vlt)
 	}
 }
 
+/*
+ * Arrange for the next timerclock() call USECS usec from now,
+ * replacing whatever countdown was in progress.
+ */
+void
+ltimer_settimerclock(uint32_t usecs)
+{
+	struct ltimer_softc *lt = timerclock_lt;
+
+	if (lt == NULL) {
+		/* Not attached yet; timerclock isn't running anyway. */
+		return;
+	}
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT, usecs);
+}
+
 /*
  * The timer device will beep if you write to the beep register. It
  * doesn't matter what value you write. This function is called if
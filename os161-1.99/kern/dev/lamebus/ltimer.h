@@ -56,4 +56,7 @@ void ltimer_beep(/*struct ltimer_softc*/ void *devdata);   // for beep device
 void ltimer_gettime(/*struct ltimer_softc*/ void *devdata,
 		    time_t *secs, uint32_t *nsecs);       // for rtclock
 
+/* Reprogram the timerclock() countdown; for the timer wheel */
+void ltimer_settimerclock(uint32_t usecs);
+
 #endif /* _LAMEBUS_LTIMER_H_ */
@@ -37,6 +37,7 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
+#include <atomic.h>
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
@@ -903,8 +904,8 @@ sfs_reclaim(struct vnode *v)
 	if (v->vn_refcount != 1) {
 
 		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+		result = atomic_dec(&v->vn_refcount);
+		KASSERT(result > 0);
 
 		vfs_biglock_release();
 		return EBUSY;
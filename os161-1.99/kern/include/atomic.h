@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on ints in memory. These are lock-free, so they
+ * may be used anywhere, including in interrupt handlers and while
+ * holding spinlocks. Like spinlocks, the guts are machine-dependent
+ * but the interface is the same everywhere.
+ *
+ *    atomic_fetchadd - add DELTA to *P; returns the old value.
+ *    atomic_cas      - if *P is OLD, set it to NEW; returns the old
+ *                      value, so it worked if that's OLD.
+ *    atomic_swap     - set *P to NEW; returns the old value.
+ *    atomic_get      - read *P.
+ *
+ * atomic_inc and atomic_dec are shorthand for adding 1 and -1, and
+ * return the new value.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+int atomic_fetchadd(volatile int *p, int delta);
+int atomic_cas(volatile int *p, int old, int new);
+int atomic_swap(volatile int *p, int new);
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+#define atomic_get(p)	(*(volatile int *)(p))
+#define atomic_inc(p)	(atomic_fetchadd((p), 1) + 1)
+#define atomic_dec(p)	(atomic_fetchadd((p), -1) - 1)
+
+
+#endif /* _ATOMIC_H_ */
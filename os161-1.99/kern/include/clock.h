@@ -38,8 +38,9 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU at least once every LT_GRANULARITY
+ * usec, and early when a timer is due sooner than that. It runs the
+ * timers.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -62,6 +63,7 @@ void hardclock(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+bool gettime_available(void);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -70,8 +72,6 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
- *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
@@ -83,5 +83,67 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * clocknanosleep() suspends execution for the requested number of
+ * nanoseconds. Unlike the others it isn't rounded to timer ticks.
+ * It returns 0, or EINTR if the current process started exiting
+ * (see uthread_exitall), which clocksleep_interrupt() makes it
+ * notice right away.
+ */
+int clocknanosleep(uint64_t nsecs);
+void clocksleep_interrupt(void);
+
+/*
+ * clock_nsecs() returns the current time in nanoseconds, or 0 if
+ * there's no clock yet.
+ */
+uint64_t clock_nsecs(void);
+
+/*
+ * Timers.
+ *
+ * A timer calls tm_func(tm_data) from the timer interrupt once its
+ * deadline has passed. The function runs in interrupt context and
+ * must not sleep.
+ *
+ * timer_init prepares a timer.
+ * timer_start arms it to expire NSECS nanoseconds from now. It must
+ *    not already be pending; it no longer is once its function has
+ *    been called, so the function may restart its own timer.
+ * timer_cancel disarms it, returning true if it hadn't yet expired.
+ *    If the function is running, waits for it to return (and disarms
+ *    the timer again if the function restarted it), so after
+ *    timer_cancel the timer may be freed.
+ *
+ * Timers are kept in per-cpu timer wheels (see thread/clock.c).
+ * timerwheel_create sets one up and is called from cpu_create.
+ */
+struct timerwheel;
+
+struct timer {
+	struct timer *tm_next;		/* list linkage */
+	struct timer **tm_prevp;
+	uint64_t tm_when;		/* deadline, in nsecs */
+	void (*tm_func)(void *);
+	void *tm_data;
+	struct timerwheel *tm_wheel;	/* NULL if not pending */
+	struct timerwheel *tm_lastwheel;	/* where it was last started */
+};
+
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_start(struct timer *tm, uint64_t nsecs);
+bool timer_cancel(struct timer *tm);
+
+void timerwheel_create(unsigned cpunum);
+
+/*
+ * Tickless idle. The idle loop calls clock_idle_enter before idling
+ * the cpu and clock_idle_exit after; in between, the cpu gets no
+ * hardclock() calls. clock_printstats reports the interrupts saved.
+ */
+void clock_idle_enter(void);
+void clock_idle_exit(void);
+void clock_printstats(void);
+
 
 #endif /* _CLOCK_H_ */
@@ -59,13 +59,20 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_leaving;	/* Yielded, not allowed here */
+	struct threadlist c_threadpool;	/* Reaped threads kept for reuse */
+	unsigned c_poolhits;		/* Forks served from c_threadpool */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	uint32_t c_stealseed;		/* Random state for thread_steal */
+	unsigned c_steals;		/* Threads taken from other cpus */
+	unsigned c_switches;		/* Context switches */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+	unsigned c_rcugen;		/* rcu_gen when last quiescent */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
@@ -109,6 +116,27 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Return the number of cpus (numbered 0 through this minus one).
+ */
+unsigned cpu_count(void);
+
+/*
+ * Return the total number of context switches on all cpus so far.
+ */
+unsigned cpu_switchcount(void);
+
+/*
+ * Return the oldest rcu_gen that some busy cpu hasn't caught up to,
+ * or GEN if they all have. For rcu.c.
+ */
+unsigned cpu_rcuseen(unsigned gen);
+
+/*
+ * Print per-cpu scheduling statistics.
+ */
+void cpu_printstats(void);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -67,6 +67,11 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+
+	/* OS/161 extensions */
+	struct timeval ru_waittime;	/* time runnable but not running */
+	struct timeval ru_sleeptime;	/* time blocked */
+	__counter_t ru_nmigrations;	/* moves between cpus (count) */
 };
 
 /* limit codes for getrusage/setrusage */
@@ -86,7 +86,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -197,6 +197,17 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling --
+#define SYS_setaffinity  121
+#define SYS_getaffinity  122
+#define SYS_settickets   123
+
+//                              -- Threads --
+#define SYS___thread_create 124
+#define SYS_thread_exit  125
+#define SYS_thread_join  126
+#define SYS_futex        127
+
 /*CALLEND*/
 
 
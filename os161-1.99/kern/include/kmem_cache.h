@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * An object cache hands out objects of one fixed size and type that
+ * are kept in a partly constructed state between uses. The
+ * constructor is called when an object is first made and the
+ * destructor when it finally goes back to kmalloc; in between, freed
+ * objects are parked in the cache with whatever the constructor set
+ * up (spinlocks, lists, subsidiary allocations) still intact. Code
+ * using a cache must therefore put objects back in the state the
+ * constructor left them in before freeing them.
+ *
+ * The structure is public so caches can be declared statically with
+ * KMEM_CACHE_INITIALIZER and used at any point during boot; code
+ * using a cache should not look inside it.
+ */
+
+#include <spinlock.h>
+
+/* Number of constructed free objects a cache will hold on to. */
+#define KMEM_CACHE_DEPTH 16
+
+struct kmem_cache {
+	const char *kc_name;		/* name, for stats */
+	size_t kc_size;			/* object size */
+	int (*kc_ctor)(void *obj);	/* constructor, or NULL */
+	void (*kc_dtor)(void *obj);	/* destructor, or NULL */
+
+	struct spinlock kc_lock;	/* protects everything below */
+	unsigned kc_nfree;		/* constructed objects on hand */
+	void *kc_free[KMEM_CACHE_DEPTH];
+
+	unsigned kc_inuse;		/* objects handed out */
+	unsigned kc_peak;		/* high-water mark of kc_inuse */
+	unsigned kc_allocs;		/* total kmem_cache_alloc calls */
+	unsigned kc_constructs;		/* total constructor calls */
+
+	bool kc_registered;		/* on the list of all caches */
+	struct kmem_cache *kc_next;	/* link for the list */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ (name), (size), (ctor), (dtor), SPINLOCK_INITIALIZER, \
+	  0, { NULL }, 0, 0, 0, 0, false, NULL }
+
+/*
+ * Operations:
+ *    kmem_cache_alloc - Get an object, constructing a new one if the
+ *                       cache is empty. Returns NULL if out of memory
+ *                       or if the constructor fails.
+ *    kmem_cache_free  - Return an object to the cache. The object
+ *                       must be back in its constructed state.
+ *    kmem_cache_printstats - Print usage for all caches in use.
+ */
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEM_CACHE_H_ */
@@ -127,6 +127,15 @@ void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * kmalloc profiling; only available if the kernel is configured with
+ * "options kmallocprof". kheap_printprof prints the MAXSITES call
+ * sites doing the most allocations, plus a summary by size class;
+ * kheap_resetprof clears the counters.
+ */
+void kheap_printprof(unsigned maxsites);
+void kheap_resetprof(void);
+
 /*
  * C string functions. 
  *
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics; only available if the kernel is
+ * configured with "options lockstat".
+ *
+ * spinlock_acquire, lock_acquire, and cv_wait report each acquisition
+ * (or wait) here, along with whether it had to wait, how many times
+ * it went around the spin loop, and how long it slept; releases report
+ * how long the lock was held. Spinlocks, which have no names, are
+ * counted by address; locks and CVs are counted by name, so all the
+ * locks with the same name are lumped together.
+ *
+ * lockstat_print prints the MAX locks with the most contended
+ * acquisitions; lockstat_reset clears the counters.
+ */
+
+#include "opt-lockstat.h"
+
+/* Kinds of lock */
+#define LOCKSTAT_SPINLOCK  0
+#define LOCKSTAT_LOCK      1
+#define LOCKSTAT_CV        2
+
+#if OPT_LOCKSTAT
+void lockstat_acquire(int kind, const void *addr, const char *name,
+		      bool contended, unsigned spins, uint64_t waitnsecs);
+void lockstat_release(int kind, const void *addr, const char *name,
+		      uint64_t holdnsecs);
+#endif
+
+void lockstat_print(unsigned max);
+void lockstat_reset(void);
+
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,13 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Stop and restart the periodic hardclock() interrupt on the current
+ * cpu. Used to avoid pointless ticks while the cpu is idle.
+ */
+void mainbus_hardclock_stop(void);
+void mainbus_hardclock_start(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -38,14 +38,29 @@
 
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <rcu.h>
 #include <opt-A2.h>
 
 struct addrspace;
 struct vnode;
+struct lock;
+struct cv;
+struct rwlock;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
+/*
+ * A thread made by __thread_create. Kept on the process's p_uthreads
+ * list, with its exit status, until it is joined.
+ */
+struct uthread {
+	int ut_tid;			/* thread id */
+	bool ut_exited;			/* has exited */
+	int ut_status;			/* exit status, once exited */
+	struct uthread *ut_next;
+};
+
 /*
  * Process structure.
  */
@@ -60,7 +75,34 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+	/*
+	 * Proportional-share scheduling; see thread.c. Protected by
+	 * the scheduler's stride lock, not p_lock.
+	 */
+	unsigned p_tickets;		/* share of the cpu */
+	uint32_t p_stride;		/* PROC_STRIDE1 / p_tickets */
+	uint64_t p_pass;		/* virtual time used so far */
+	unsigned p_nawake;		/* threads not asleep; see stride_rejoin */
+
+	/*
+	 * Scheduling statistics of threads that have left the
+	 * process; see getrusage. Protected by p_lock.
+	 */
+	struct schedstats p_stats;
+
+	/*
+	 * User-level threads; see syscall/uthread_syscalls.c.
+	 * Protected by p_threadlock.
+	 */
+	struct lock *p_threadlock;
+	struct cv *p_threadcv;		/* thread exits, process exit */
+	int p_nexttid;			/* next thread id to hand out */
+	bool p_exiting;			/* other threads should exit */
+	struct uthread *p_uthreads;	/* created and not yet joined */
+
 #ifdef UW
+	bool p_counted;			/* included in the process count */
+
   /* a vnode to refer to the console device */
   /* this is a quick-and-dirty way to get console writes working */
   /* you will probably need to change this when implementing file-related
@@ -92,19 +134,49 @@ struct procinfo {
     pid_t ppid;
     int exit_status;
     enum state_t state;
+    struct rcu_head rcu;	/* for freeing it once unlinked */
+    struct procinfo *retired_next;	/* see procinfo_retire */
 };
 
 DECLARRAY(procinfo);
 DEFARRAY(procinfo, PROCINLINE);
 struct procinfoarray *procinfolist;
+/* guards the contents of procinfolist */
+struct rwlock *procinfolist_rwlock;
+/* with procinfolist_cv, for waiting on procinfo state changes */
 struct lock *procinfolist_lock;
 struct cv *procinfolist_cv;
 
 struct procinfo *procinfoarray_get_by_pid(struct procinfoarray *pa, pid_t pid);
 void procinfoarray_remove_by_pid(struct procinfoarray *pa, pid_t pid);
+/*
+ * procinfoarray_get_by_pid on procinfolist. Uses the copy published
+ * by procinfo_publish, without locking, if procinfo_rcu is set and
+ * there is one; otherwise holds the rwlock for reading.
+ */
+struct procinfo *procinfo_lookup(pid_t pid);
+/*
+ * Hand over an entry that has been removed from procinfolist, to be
+ * freed once lock-free lookups are done with it. Call with the rwlock
+ * held for writing, before procinfo_publish.
+ */
+void procinfo_retire(struct procinfo *pi);
+/*
+ * Publish the current contents of procinfolist for procinfo_lookup,
+ * and free (via rcu) the entries retired since the last time. Call
+ * with the rwlock held for writing, after changing the list.
+ */
+void procinfo_publish(void);
+/* Whether procinfo_lookup uses the published copy; for benchmarking */
+extern bool procinfo_rcu;
 
 #endif
 
+/* Stride scheduling parameters. */
+#define PROC_STRIDE1      (1U << 20)	/* stride of a one-ticket process */
+#define PROC_DEFTICKETS   100		/* tickets a new process gets */
+#define PROC_MAXTICKETS   10000
+
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
@@ -119,6 +191,13 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
+/*
+ * Create an empty process for kernel-only threads, such as the ones
+ * made by tests that need several processes. It has no address space
+ * or console, and isn't counted as a user process.
+ */
+struct proc *proc_create_kernel(const char *name);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
@@ -128,6 +207,9 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Sum the scheduling statistics of a process's threads, past and present. */
+void proc_getstats(struct proc *proc, struct schedstats *ss);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update: lock-free readers for data that's read far more
+ * often than it's changed.
+ *
+ * Readers bracket their accesses with rcu_read_lock/rcu_read_unlock
+ * and don't take any locks. A read section must not sleep or yield;
+ * it runs with interrupts off, so keep it short. Pointers found
+ * inside it are only good until rcu_read_unlock unless something
+ * else keeps the object alive.
+ *
+ * Writers, serialized among themselves by some ordinary lock, don't
+ * rearrange anything readers walk through. They build a new version,
+ * publish it by storing the pointer, and hand the old one to
+ * rcu_free. It's kfree'd only after every cpu has gone through
+ * thread_switch or taken a clock interrupt (or been idle) since, at
+ * which point no reader can still be looking at it. rcu_synchronize
+ * waits for that to happen for everything published so far.
+ *
+ * Freeing is done by later calls to rcu_free and rcu_synchronize,
+ * so a few old versions may hang around until the next update.
+ */
+
+/*
+ * Per-object bookkeeping for rcu_free. Embed one in anything freed
+ * that way; readers should leave it alone.
+ */
+struct rcu_head {
+	struct rcu_head *rh_next;	/* Next on the pending list */
+	unsigned rh_gen;		/* Grace period it waits for */
+	void *rh_ptr;			/* What to kfree */
+};
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+/*
+ * Free PTR, which contains RH, once no reader can be using it. Must
+ * be called after PTR has been unpublished. Doesn't sleep.
+ */
+void rcu_free(struct rcu_head *rh, void *ptr);
+
+/*
+ * Wait until every read section that was running when this was
+ * called has finished. Sleeps, so not for interrupt handlers or read
+ * sections.
+ */
+void rcu_synchronize(void);
+
+/*
+ * Counter advanced by each writer; each cpu copies it in
+ * thread_switch and schedule to say it's outside any read section.
+ */
+extern volatile unsigned rcu_gen;
+
+
+#endif /* _RCU_H_ */
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include "opt-lockstat.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -62,6 +63,21 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P_timed is P with a time limit of NSECS nanoseconds. It returns 0,
+ * or ETIMEDOUT if the count stayed 0 the whole time.
+ */
+int P_timed(struct semaphore *, uint64_t nsecs);
+
+/*
+ * P_intr is P for waits on behalf of a user process that may never
+ * end, like waiting for input. It returns 0, or EINTR if the process
+ * started exiting (see uthread_exitall). sem_interrupt wakes all its
+ * waiters so they check.
+ */
+int P_intr(struct semaphore *);
+void sem_interrupt(struct semaphore *);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -72,6 +88,8 @@ void V(struct semaphore *);
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
  */
+#define LOCK_NLEVELS  4         // thread priority levels (MLFQ_NLEVELS)
+
 struct lock {
         char *lk_name;
         // add what you need here
@@ -79,7 +97,17 @@ struct lock {
         struct wchan *lk_wchan;
         struct spinlock lk_spinlock;
         // we need one more field as compared to semaphore, the owner of the lock.
-        struct thread *lk_owner; 
+        // (volatile because lock_acquire polls it while spinning)
+        struct thread *volatile lk_owner;
+        bool lk_handoff;         // see lock_sethandoff
+        // priority inheritance: sleeping waiters at each level, and
+        // the next lock held by lk_owner (see lock_inheritance)
+        unsigned lk_waiters[LOCK_NLEVELS];
+        unsigned lk_nblocked;
+        struct lock *lk_heldnext;
+#if OPT_LOCKSTAT
+        uint64_t lk_acquiredat;  // when the owner got it
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -100,6 +128,38 @@ void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
 
+/*
+ * Locks are adaptive: if the holder is running on another cpu,
+ * lock_acquire spins for up to lock_spinlimit tries, expecting the
+ * lock to be released soon, before going to sleep. Setting it to 0
+ * makes lock_acquire always sleep right away.
+ */
+#define LOCK_SPINLIMIT  2000
+extern unsigned lock_spinlimit;
+
+/*
+ * By default a released lock is up for grabs: the thread woken by
+ * lock_release has to compete for it with anyone who comes along (or
+ * is spinning) before it gets to run, and usually loses. That's good
+ * for throughput but a waiter can starve. In handoff mode
+ * lock_release instead makes the longest waiter the owner on the
+ * spot, so waiters get the lock in FIFO order, at the cost of a
+ * context switch on every contended release.
+ */
+void lock_sethandoff(struct lock *, bool handoff);
+
+/*
+ * Priority inheritance. A thread that goes to sleep waiting for a
+ * lock lends its priority level to the owner, and, if the owner is
+ * itself asleep waiting for another lock, to that lock's owner, and
+ * so on down the chain. The owner keeps the best level lent to it by
+ * sleepers on any lock it still holds; releasing a lock drops what
+ * came through that lock. A thread's own (base) level is untouched,
+ * so the feedback queue goes on working as usual underneath. Setting
+ * lock_inheritance to false turns this off for new waiters.
+ */
+extern bool lock_inheritance;
+
 
 /*
  * Condition variable.
@@ -131,8 +191,11 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - Like cv_wait, but wake up anyway after NSECS
+ *                   nanoseconds. Returns 0 if signalled, ETIMEDOUT
+ *                   if not; the lock is reacquired either way.
  *
- * For all three operations, the current thread must hold the lock passed 
+ * For all of these operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -141,6 +204,141 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, uint64_t nsecs);
+
+/*
+ * Since the signaller holds the lock, a thread woken from a cv would
+ * only run far enough to block again in lock_acquire. So by default
+ * (wait morphing) cv_signal and cv_broadcast don't wake anyone; they
+ * move the waiters onto the lock's wait channel, and each lock_release
+ * then wakes one of them. This relies on a cv always being used with
+ * the same lock. Setting cv_waitmorph to false wakes waiters right
+ * away instead.
+ */
+extern bool cv_waitmorph;
+
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too. To keep readers from starving in turn, a writer releasing the
+ * lock lets in every reader that was waiting, all at once, before the
+ * next writer gets a turn.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock {
+	char *rw_name;
+	struct spinlock rw_lock;
+	struct wchan *rw_readwchan;	/* readers wait here */
+	struct wchan *rw_writewchan;	/* writers wait here */
+	unsigned rw_readers;		/* readers holding the lock */
+	unsigned rw_waitreaders;	/* readers waiting */
+	unsigned rw_waitwriters;	/* writers waiting */
+	unsigned rw_gen;		/* bumped when readers are let in */
+	struct thread *rw_writer;	/* writer holding the lock */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread
+ *                   holds the lock for writing. (There is no way
+ *                   to tell which threads are readers.)
+ *
+ * The lock is not recursive, in either mode, and can't be upgraded.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
+/*
+ * Barrier.
+ *
+ * Made for a fixed number of threads. Each calls barrier_wait, which
+ * blocks until the last of them arrives; then they are all let go at
+ * once, in one wakeup pass. The barrier resets itself, so the same
+ * threads can go through it again at the end of the next phase.
+ *
+ * barrier_wait returns true in exactly one thread per round (the
+ * last to arrive), for anything that should happen once between
+ * phases.
+ *
+ * The barrier may be destroyed as soon as barrier_wait has returned
+ * in any thread; the others don't touch it again after waking.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct barrier {
+	char *b_name;
+	struct spinlock b_lock;
+	struct wchan *b_wchan;
+	unsigned b_count;		/* threads per round */
+	unsigned b_arrived;		/* threads in so far this round */
+};
+
+struct barrier *barrier_create(const char *name, unsigned count);
+void barrier_destroy(struct barrier *);
+bool barrier_wait(struct barrier *);
+
+
+/*
+ * Completion.
+ *
+ * An event threads can wait for, such as "setup is done, go" or
+ * "the worker has finished".
+ *
+ * Operations:
+ *    completion_wait   - Block until the event has happened.
+ *    complete          - Let one waiter through; if nobody's waiting
+ *                        yet, the next thread to wait goes through.
+ *    complete_all      - Let every waiter through, in one wakeup
+ *                        pass, and everyone who waits from now on
+ *                        until completion_reinit.
+ *    completion_reinit - Make it not have happened again. Nobody
+ *                        may be waiting.
+ *
+ * As with barriers, woken waiters don't touch the completion again.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct completion {
+	char *cm_name;
+	struct spinlock cm_lock;
+	struct wchan *cm_wchan;
+	unsigned cm_done;		/* completes not yet waited for */
+	bool cm_all;			/* complete_all was called */
+};
+
+struct completion *completion_create(const char *name);
+void completion_destroy(struct completion *);
+void completion_wait(struct completion *);
+void complete(struct completion *);
+void complete_all(struct completion *);
+void completion_reinit(struct completion *);
+
+/*
+ * The test harnesses in test/ and synchprobs/ use the two together:
+ * the workers wait on a start completion that the main thread
+ * complete_alls once it has forked them all, so they start together,
+ * and everyone, the main thread included, waits at a done barrier
+ * made for the workers plus one, so the main thread knows when
+ * they've finished.
+ */
 
 
 #endif /* _SYNCH_H_ */
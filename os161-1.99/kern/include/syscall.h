@@ -33,6 +33,7 @@
 #include <opt-A2.h>
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct proc; /* from <proc.h> */
 
 /*
  * The system call dispatcher.
@@ -51,6 +52,25 @@ void enter_forked_process(struct trapframe *tf);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
+/*
+ * Enter user mode in a new thread of an existing process. GP is the
+ * global pointer register to start with, copied from the creator.
+ */
+void enter_new_thread(userptr_t arg, vaddr_t stackptr, vaddr_t entrypoint,
+		      vaddr_t gp);
+
+/*
+ * User-level thread support; see uthread_syscalls.c for which kernel
+ * sleeps uthread_exitall can interrupt and which it can't.
+ */
+bool uthread_exiting(void);
+void uthread_checkexit(void);
+void uthread_exitall(void);
+
+/* Futexes; see futex_syscalls.c */
+void futex_bootstrap(void);
+void futex_interrupt(struct proc *p);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -58,6 +78,11 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t req, userptr_t rem);
+int sys_setaffinity(uint32_t mask);
+int sys_getaffinity(userptr_t user_mask);
+int sys_settickets(int tickets);
+int sys_getrusage(int who, userptr_t user_rusage_ptr);
 
 #if OPT_A2
 int sys_fork(struct trapframe *tf, int *retval);
@@ -69,6 +94,11 @@ int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys___thread_create(userptr_t entry, userptr_t arg, userptr_t stack,
+			vaddr_t gp, int *retval);
+void sys_thread_exit(int status);
+int sys_thread_join(int tid, userptr_t user_status);
+int sys_futex(userptr_t uaddr, int op, int val, int *retval);
 
 #endif // UW
 
@@ -57,10 +57,33 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 
+/* synchronization benchmarks */
+int cvbroadcastbench(int, char **);
+int lockbench(int, char **);
+int rwlockbench(int, char **);
+int spinlockbench(int, char **);
+int lockhandoffbench(int, char **);
+int cvmorphbench(int, char **);
+int pidlookupbench(int, char **);
+
+/* benchmark helpers, also used by lookupbench; see synchbench.c */
+extern struct semaphore *sb_done;
+void sb_init(void);
+void sb_forkon(const char *name, void (*func)(void *, unsigned long),
+	       unsigned long num, unsigned cpu);
+unsigned sb_rate(uint64_t nops, uint64_t nsecs);
+
+/* scheduler tests */
+int schedlatencytest(int, char **);
+int schedsharetest(int, char **);
+int schedinversiontest(int, char **);
+int schedaffinitytest(int, char **);
+
 #ifdef UW
 /* Another thread and synchronization test */
 int uwlocktest1(int, char **);
@@ -74,11 +97,13 @@ int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
+int lookupbench(int, char **);
 int printfile(int, char **);
 
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int mallocthroughput(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
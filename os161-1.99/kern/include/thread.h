@@ -55,6 +55,29 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are kept in the thread, not kstrdup'd */
+#define THREAD_NAMELEN 16
+
+/* Max number of exited threads, with stacks, kept per cpu for reuse */
+#define THREAD_POOLSIZE 8
+
+/* Number of feedback queue (priority) levels; see schedule() */
+#define MLFQ_NLEVELS 4
+
+
+/*
+ * Scheduling statistics, kept per thread and summed per process. The
+ * scheduler updates them without locking, so readers on other cpus
+ * may see values that are slightly out of date.
+ */
+struct schedstats {
+	unsigned ss_runticks;		/* hardclocks while running */
+	uint64_t ss_readywait;		/* nsecs spent on run queues */
+	uint64_t ss_sleeptime;		/* nsecs spent asleep */
+	unsigned ss_nvcsw;		/* voluntary switches (slept) */
+	unsigned ss_nivcsw;		/* involuntary switches (yielded) */
+	unsigned ss_migrations;		/* times moved to another cpu */
+};
 
 /* States a thread can be in. */
 typedef enum {
@@ -83,6 +106,39 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	int t_tid;			/* Thread id within the process */
+	char t_namebuf[THREAD_NAMELEN];	/* Storage for short t_name */
+	struct thread *t_allnext;	/* List of all threads, for top */
+	struct thread **t_allprevp;
+
+	/*
+	 * Scheduler fields. These belong to the run queue the thread
+	 * is on, or to the thread itself while it runs.
+	 */
+	unsigned t_priority;		/* Feedback queue level, 0 = highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	uint32_t t_affinity;		/* Mask of cpu numbers we may run on */
+	bool t_strideawake;		/* counted in t_proc->p_nawake */
+
+	/*
+	 * Priority inheritance (see synch.c), protected by the
+	 * inheritance lock there. t_priority stays the base level;
+	 * the scheduler uses THREAD_PRIORITY.
+	 */
+	unsigned t_inherited;		/* Level lent by lock waiters */
+	struct lock *t_blockedon;	/* Lock we're asleep waiting for */
+	unsigned t_blockedlevel;	/* Level we're counted at there */
+	struct lock *t_heldlocks;	/* Locks we hold (owner only) */
+
+	/* Accounting; see struct schedstats */
+	struct schedstats t_stats;
+	uint64_t t_statesince;		/* when it last became ready/asleep */
+
+	/*
+	 * Sleep state, protected by the lock of the wait channel.
+	 */
+	struct wchan *t_wchan;		/* Channel we're on, if sleeping */
+	bool t_timedout;		/* Woken by timeout, not wakeup */
 
 	/*
 	 * Interrupt state fields.
@@ -100,6 +156,7 @@ struct thread {
 	bool t_in_interrupt;		/* Are we in an interrupt? */
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
+	int t_rcudepth;			/* Nested rcu_read_lock calls */
 
 	/*
 	 * Public fields
@@ -108,6 +165,11 @@ struct thread {
 	/* add more here as needed */
 };
 
+/* A thread's effective priority level: its own, or what it inherited. */
+#define THREAD_PRIORITY(t) \
+	((t)->t_inherited < (t)->t_priority ? \
+	 (t)->t_inherited : (t)->t_priority)
+
 /*
  * Array of threads.
  */
@@ -158,7 +220,51 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Set or get the set of cpus the current thread may run on, as a
+ * bitmask indexed by cpu number. Threads start out allowed on every
+ * cpu, and new threads inherit the mask of the thread that forked
+ * them. thread_setaffinity fails with EINVAL if no cpu in the mask
+ * exists. If the current cpu is not in the new mask, the thread moves
+ * to one that is before thread_setaffinity returns (unless memory is
+ * too short to do that, in which case it moves the next time it
+ * sleeps or yields).
+ */
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
+/*
+ * Set the number of tickets (share of the cpu, relative to other
+ * processes) of the current process. Fails with EINVAL unless
+ * 1 <= TICKETS <= PROC_MAXTICKETS.
+ */
+int thread_settickets(unsigned tickets);
+
+/*
+ * Stop counting thread T as awake for stride scheduling. Called when
+ * it goes to sleep, and by proc_remthread when it leaves its process.
+ */
+void thread_stride_leave(struct thread *t);
+
+/*
+ * Set the priority level thread T inherits from threads waiting for
+ * locks it holds (MLFQ_NLEVELS for none), moving it within its run
+ * queue if it's on one. For the lock code; see synch.c.
+ */
+void thread_inherit(struct thread *t, unsigned level);
+
+/*
+ * Add the statistics in FROM to TO.
+ */
+void schedstats_add(struct schedstats *to, const struct schedstats *from);
+
+/*
+ * Print a top-like table of threads, busiest first; at most MAX rows.
+ */
+void thread_printtop(unsigned max);
+
+/*
+ * Charge a tick to the current thread, adjust priorities, and
+ * preempt if needed. Called from the timer interrupt.
  */
 void schedule(void);
 
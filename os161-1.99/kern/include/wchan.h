@@ -71,6 +71,13 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but also wake up after NSECS nanoseconds if
+ * nobody else has. Returns 0 if woken by wchan_wake*, or ETIMEDOUT
+ * if the time ran out.
+ */
+int wchan_sleep_timeout(struct wchan *wc, uint64_t nsecs);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
@@ -81,5 +88,23 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up the thread that has been sleeping longest, and return it,
+ * or NULL if nobody was sleeping. This is for handing something
+ * straight to the woken thread. The caller must hold whatever the
+ * thread takes first on waking up (e.g. the spinlock it slept with)
+ * until done with the pointer, or the thread may run off with it.
+ */
+struct thread *wchan_wakehead(struct wchan *wc);
+
+/*
+ * Move the head thread (or, if ALL is true, every thread) sleeping on
+ * FROM over to TO without waking it up; it'll be woken by a wakeup on
+ * TO instead. Returns the number of threads moved. FROM is locked
+ * before TO, so threads must always be moved in the same direction
+ * between any two channels.
+ */
+unsigned wchan_requeue(struct wchan *from, struct wchan *to, bool all);
+
 
 #endif /* _WCHAN_H_ */
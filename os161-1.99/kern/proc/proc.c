@@ -45,12 +45,15 @@
 #define PROCINLINE
 
 #include <types.h>
+#include <kern/errno.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <kmem_cache.h>
+#include <rcu.h>
 #include <kern/fcntl.h>  
 
 /*
@@ -85,6 +88,101 @@ struct procinfo *procinfoarray_get_by_pid(struct procinfoarray *pa, pid_t pid) {
     return NULL;
 }
 
+/*
+ * Read-only snapshot of procinfolist for lock-free lookups. The array
+ * in procinfolist gets reallocated as it grows, so readers that don't
+ * hold the rwlock can't walk it; instead, each change publishes a
+ * fresh copy of the entry pointers here and the old copy is freed by
+ * rcu. NULL if the last copy couldn't be allocated, in which case
+ * lookups go back to the rwlock.
+ */
+struct procinfotable {
+    struct rcu_head pt_rcu;
+    unsigned pt_num;
+    struct procinfo *pt_entries[];
+};
+
+static struct procinfotable *volatile procinfo_table;
+bool procinfo_rcu = true;
+
+/* Entries removed from procinfolist since the last publish. */
+static struct procinfo *procinfo_retired;
+
+/*
+ * Find the procinfo for PID in procinfolist. Lookups don't lock
+ * anything unless there's no published table. The entry found is
+ * only removed by its own process exiting or being reaped, which the
+ * caller has to allow for; until it's removed it stays valid after
+ * the read section ends.
+ */
+struct procinfo *procinfo_lookup(pid_t pid) {
+    struct procinfotable *pt;
+    struct procinfo *pi;
+
+    if (procinfo_rcu) {
+        rcu_read_lock();
+        pt = procinfo_table;
+        if (pt != NULL) {
+            pi = NULL;
+            for (unsigned i=0; i<pt->pt_num; ++i) {
+                if (pt->pt_entries[i]->pid == pid) {
+                    pi = pt->pt_entries[i];
+                    break;
+                }
+            }
+            rcu_read_unlock();
+            return pi;
+        }
+        rcu_read_unlock();
+    }
+
+    rwlock_acquire_read(procinfolist_rwlock);
+    pi = procinfoarray_get_by_pid(procinfolist, pid);
+    rwlock_release_read(procinfolist_rwlock);
+    return pi;
+}
+
+void procinfo_retire(struct procinfo *pi) {
+    KASSERT(rwlock_do_i_hold_write(procinfolist_rwlock));
+
+    pi->retired_next = procinfo_retired;
+    procinfo_retired = pi;
+}
+
+void procinfo_publish(void) {
+    struct procinfotable *old, *pt;
+    struct procinfo *pi;
+    unsigned num;
+
+    KASSERT(rwlock_do_i_hold_write(procinfolist_rwlock));
+
+    num = procinfoarray_num(procinfolist);
+    pt = kmalloc(sizeof(*pt) + num * sizeof(pt->pt_entries[0]));
+    if (pt != NULL) {
+        pt->pt_num = num;
+        for (unsigned i=0; i<num; ++i) {
+            pt->pt_entries[i] = procinfoarray_get(procinfolist, i);
+        }
+    }
+
+    old = procinfo_table;
+    procinfo_table = pt;
+
+    /*
+     * Retired entries aren't in the new table (or in any, if we're
+     * out of memory), so they can go once readers of the old one are
+     * done with them.
+     */
+    while (procinfo_retired != NULL) {
+        pi = procinfo_retired;
+        procinfo_retired = pi->retired_next;
+        rcu_free(&pi->rcu, pi);
+    }
+    if (old != NULL) {
+        rcu_free(&old->pt_rcu, old);
+    }
+}
+
 void procinfoarray_remove_by_pid(struct procinfoarray *pa, pid_t pid) {
     unsigned size = procinfoarray_num(pa);
     for (unsigned i=0; i<size; ++i) {
@@ -98,6 +196,47 @@ void procinfoarray_remove_by_pid(struct procinfoarray *pa, pid_t pid) {
 
 #endif
 
+/*
+ * Object cache for proc structures. The thread array (including its
+ * storage), the spinlock, and the thread lock and cv are kept
+ * initialized between uses.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_threadlock = lock_create("p_threadlock");
+	if (proc->p_threadlock == NULL) {
+		return ENOMEM;
+	}
+	proc->p_threadcv = cv_create("p_threadcv");
+	if (proc->p_threadcv == NULL) {
+		lock_destroy(proc->p_threadlock);
+		return ENOMEM;
+	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->p_threadcv);
+	lock_destroy(proc->p_threadlock);
+}
+
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor);
+
 /*
  * Create a proc structure.
  */
@@ -107,18 +246,18 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
+	/* (p_threads and p_lock are set up by proc_ctor) */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -126,7 +265,20 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
+	/* Scheduling fields; thread_make_runnable catches up p_pass */
+	proc->p_tickets = PROC_DEFTICKETS;
+	proc->p_stride = PROC_STRIDE1 / PROC_DEFTICKETS;
+	proc->p_pass = 0;
+	proc->p_nawake = 0;
+	bzero(&proc->p_stats, sizeof(proc->p_stats));
+
+	/* User-level threads; the first thread is number 0 */
+	proc->p_nexttid = 1;
+	proc->p_exiting = false;
+	proc->p_uthreads = NULL;
+
 #ifdef UW
+	proc->p_counted = false;
 	proc->console = NULL;
 #endif // UW
 
@@ -139,6 +291,10 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+#ifdef UW
+	bool counted;
+#endif
+
 	/*
          * note: some parts of the process structure, such as the address space,
          *  are destroyed in sys_exit, before we get here
@@ -190,25 +346,40 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	/* Threads nobody joined */
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
+
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
+
+	/* Back to the state proc_ctor left it in. */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	KASSERT(!spinlock_do_i_hold(&proc->p_lock));
+	KASSERT(!lock_do_i_hold(proc->p_threadlock));
+
+#ifdef UW
+	counted = proc->p_counted;
+#endif
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
-        /* note: kproc is not included in the process count, but proc_destroy
-	   is never called on kproc (see KASSERT above), so we're OK to decrement
-	   the proc_count unconditionally here */
-	P(proc_count_mutex); 
-	KASSERT(proc_count > 0);
-	proc_count--;
-	/* signal the kernel menu thread if the process count has reached zero */
-	if (proc_count == 0) {
-	  V(no_proc_sem);
+        /* note: kproc is not included in the process count, and neither
+	   are processes from proc_create_kernel; p_counted tells which is which */
+	if (counted) {
+	  P(proc_count_mutex); 
+	  KASSERT(proc_count > 0);
+	  proc_count--;
+	  /* signal the kernel menu thread if the process count has reached zero */
+	  if (proc_count == 0) {
+	    V(no_proc_sem);
+	  }
+	  V(proc_count_mutex);
 	}
-	V(proc_count_mutex);
 #endif // UW
 	
 
@@ -295,15 +466,20 @@ proc_create_runprogram(const char *name)
            are created using a call to proc_create_runprogram  */
 	P(proc_count_mutex); 
 	proc_count++;
+	proc->p_counted = true;
 	V(proc_count_mutex);
 #endif // UW
 
 #if OPT_A2
     if (!procinfolist_lock) {
         procinfolist_lock = lock_create("procinfolist_lock");
+        procinfolist_rwlock = rwlock_create("procinfolist_rwlock");
+        if (!procinfolist_lock || !procinfolist_rwlock) {
+            panic("proc_create: cannot create procinfolist locks\n");
+        }
     }
 
-    lock_acquire(procinfolist_lock);
+    rwlock_acquire_write(procinfolist_rwlock);
 
     if (!procinfolist) {
         procinfolist = procinfoarray_create();
@@ -341,13 +517,23 @@ proc_create_runprogram(const char *name)
 
     unsigned index;
     procinfoarray_add(procinfolist, pi, &index);
+    procinfo_publish();
 
-    lock_release(procinfolist_lock);
+    rwlock_release_write(procinfolist_rwlock);
 #endif
 
 	return proc;
 }
 
+/*
+ * Create a process for kernel-only threads.
+ */
+struct proc *
+proc_create_kernel(const char *name)
+{
+	return proc_create(name);
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -388,7 +574,9 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			schedstats_add(&proc->p_stats, &t->t_stats);
 			spinlock_release(&proc->p_lock);
+			thread_stride_leave(t);
 			t->t_proc = NULL;
 			return;
 		}
@@ -398,6 +586,24 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Get the scheduling statistics for a process: those of its exited
+ * threads plus those of the ones still running.
+ */
+void
+proc_getstats(struct proc *proc, struct schedstats *ss)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	*ss = proc->p_stats;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		schedstats_add(ss, &threadarray_get(&proc->p_threads, i)->t_stats);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
@@ -42,9 +43,11 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-kmallocprof.h"
 #include <opt-A2.h>
 
 /*
@@ -419,6 +422,96 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printstats();
+	clock_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing the busiest threads.
+ */
+static
+int
+cmd_top(int nargs, char **args)
+{
+	int max = 20;
+
+	if (nargs > 2) {
+		kprintf("Usage: top [rows]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		max = atoi(args[1]);
+		if (max <= 0) {
+			max = 1;
+		}
+	}
+
+	thread_printtop(max);
+	return 0;
+}
+
+#if OPT_KMALLOCPROF
+/*
+ * Command for printing (or clearing) the kmalloc profile.
+ */
+static
+int
+cmd_kheapprof(int nargs, char **args)
+{
+	unsigned maxsites = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: kmp [nsites | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			kheap_resetprof();
+			return 0;
+		}
+		maxsites = atoi(args[1]);
+	}
+
+	kheap_printprof(maxsites);
+	return 0;
+}
+#endif /* OPT_KMALLOCPROF */
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing (or clearing) lock contention statistics.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	unsigned maxlocks = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lks [nlocks | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			lockstat_reset();
+			return 0;
+		}
+		maxlocks = atoi(args[1]);
+	}
+
+	lockstat_print(maxlocks);
+	return 0;
+}
+#endif /* OPT_LOCKSTAT */
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -480,15 +573,28 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kmalloc throughput test       ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork/exit throughput   ",
+	"[sc1] Scheduler latency test        ",
+	"[sc2] Proportional share test       ",
+	"[sc3] Priority inversion test       ",
+	"[sc4] Affinity test                 ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sb1] cv_broadcast benchmark        ",
+	"[sb2] Lock throughput benchmark     ",
+	"[sb3] Reader scaling benchmark      ",
+	"[sb4] Spinlock contention benchmark ",
+	"[sb5] Lock handoff benchmark        ",
+	"[sb6] cv wait morphing benchmark    ",
+	"[sb7] pid lookup (rcu) benchmark    ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -498,6 +604,7 @@ static const char *testmenu[] = {
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[fs6] Path lookup benchmark         ",
 	NULL
 };
 
@@ -529,6 +636,14 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[cpu] CPU scheduler stats           ",
+	"[top] Busiest threads               ",
+#if OPT_KMALLOCPROF
+	"[kmp] Kernel heap profile           ",
+#endif
+#if OPT_LOCKSTAT
+	"[lks] Lock contention stats         ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -586,23 +701,46 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "cpu",	cmd_cpustats },
+	{ "top",	cmd_top },
+#if OPT_KMALLOCPROF
+	{ "kmp",	cmd_kheapprof },
+#endif
+#if OPT_LOCKSTAT
+	{ "lks",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	mallocthroughput },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
+	{ "sc1",	schedlatencytest },
+	{ "sc2",	schedsharetest },
+	{ "sc3",	schedinversiontest },
+	{ "sc4",	schedaffinitytest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+
+	/* synchronization benchmarks */
+	{ "sb1",	cvbroadcastbench },
+	{ "sb2",	lockbench },
+	{ "sb3",	rwlockbench },
+	{ "sb4",	spinlockbench },
+	{ "sb5",	lockhandoffbench },
+	{ "sb6",	cvmorphbench },
+	{ "sb7",	pidlookupbench },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -614,6 +752,7 @@ static struct {
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+	{ "fs6",	lookupbench },
 
 	{ NULL, NULL }
 };
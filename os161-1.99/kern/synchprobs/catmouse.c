@@ -75,12 +75,9 @@ static int CatSleepTime = 2;    // length of time a cat spends sleeping
 static int MouseEatTime = 1;    // length of time a mouse spends eating
 static int MouseSleepTime = 2;  // length of time a mouse spends sleeping
 
-/*
- * Once the main driver function (catmouse()) has created the cat and mouse
- * simulation threads, it uses this semaphore to block until all of the
- * cat and mouse simulations are finished.
- */
-static struct semaphore *CatMouseWait;
+/* Start and done for the cat and mouse threads (see synch.h). */
+static struct completion *CatMouseStart;
+static struct barrier *CatMouseWait;
 
 /*
  *
@@ -521,6 +518,8 @@ cat_simulation(void * unusedpointer,
   (void) unusedpointer;
   (void) catnumber;
 
+  /* wait for all of the cats and mice to be created */
+  completion_wait(CatMouseStart);
 
   for(i=0;i<NumLoops;i++) {
 
@@ -553,7 +552,7 @@ cat_simulation(void * unusedpointer,
   }
 
   /* indicate that this cat simulation is finished */
-  V(CatMouseWait); 
+  barrier_wait(CatMouseWait);
 }
 
 /*
@@ -585,6 +584,9 @@ mouse_simulation(void * unusedpointer,
   (void) unusedpointer;
   (void) mousenumber;
 
+  /* wait for all of the cats and mice to be created */
+  completion_wait(CatMouseStart);
+
   for(i=0;i<NumLoops;i++) {
 
     /* make the mouse sleep */
@@ -616,7 +618,7 @@ mouse_simulation(void * unusedpointer,
   }
 
   /* indicate that this mouse is finished */
-  V(CatMouseWait); 
+  barrier_wait(CatMouseWait);
 }
 
 /*
@@ -647,7 +649,6 @@ catmouse(int nargs,
          char ** args)
 {
   int catindex, mouseindex, error;
-  int i;
   int mean_cat_wait_usecs, mean_mouse_wait_usecs;
   time_t before_sec, after_sec, wait_sec;
   uint32_t before_nsec, after_nsec, wait_nsec;
@@ -719,11 +720,16 @@ catmouse(int nargs,
   kprintf("Using cat eating time %d, cat sleeping time %d\n", CatEatTime, CatSleepTime);
   kprintf("Using mouse eating time %d, mouse sleeping time %d\n", MouseEatTime, MouseSleepTime);
 
-  /* create the semaphore that is used to make the main thread
-     wait for all of the cats and mice to finish */
-  CatMouseWait = sem_create("CatMouseWait",0);
+  /* create the completion that starts the cats and mice together, and
+     the barrier that is used to make the main thread wait for all of
+     the cats and mice to finish */
+  CatMouseStart = completion_create("CatMouseStart");
+  if (CatMouseStart == NULL) {
+    panic("catmouse: could not create completion\n");
+  }
+  CatMouseWait = barrier_create("CatMouseWait",NumCats+NumMice+1);
   if (CatMouseWait == NULL) {
-    panic("catmouse: could not create semaphore\n");
+    panic("catmouse: could not create barrier\n");
   }
 
   /* initialize our simulation state */
@@ -732,9 +738,6 @@ catmouse(int nargs,
   /* initialize the synchronization functions */
   catmouse_sync_init(NumBowls);
 
-  /* get current time, for measuring total simulation time */
-  gettime(&before_sec,&before_nsec);
-
   /*
    * Start NumCats cat_simulation() threads and NumMice mouse_simulation() threads.
    * Alternate cat and mouse creation.
@@ -759,11 +762,15 @@ catmouse(int nargs,
     }
   }
   
+  /* get current time, for measuring total simulation time */
+  gettime(&before_sec,&before_nsec);
+
+  /* let them all go */
+  complete_all(CatMouseStart);
+
   /* wait for all of the cats and mice to finish before
      terminating */  
-  for(i=0;i<(NumCats+NumMice);i++) {
-    P(CatMouseWait);
-  }
+  barrier_wait(CatMouseWait);
 
   /* get current time, for measuring total simulation time */
   gettime(&after_sec,&after_nsec);
@@ -777,8 +784,9 @@ catmouse(int nargs,
     kprintf("STATS: Bowl utilization: %d%%\n",utilization_percent);
   }
 
-  /* clean up the semaphore that we created */
-  sem_destroy(CatMouseWait);
+  /* clean up the completion and barrier that we created */
+  completion_destroy(CatMouseStart);
+  barrier_destroy(CatMouseWait);
 
   /* clean up the synchronization state */
   catmouse_sync_cleanup(NumBowls);
@@ -50,12 +50,9 @@ static int InterArrivalTime = 1;      // time between vehicle arrivals
 static int ServiceTime = 1;    // time in the intersection
 static int DirectionBias = 0;  // 0 = unbiased, 1 = biased
 
-/*
- * Once the main driver function has created the 
- * simulation threads, it uses this semaphore to block until all of the
- * simulation threads are finished.
- */
-static struct semaphore *SimulationWait;
+/* Start and done for the simulation threads (see synch.h). */
+static struct completion *SimulationStart;
+static struct barrier *SimulationWait;
 
 /*
  *
@@ -349,9 +346,13 @@ initialize_state(void)
   if (perf_mutex == NULL) {
     panic("could not create perf_mutex semaphore\n");
   }
-  SimulationWait = sem_create("SimulationWait",0);
+  SimulationStart = completion_create("SimulationStart");
+  if (SimulationStart == NULL) {
+    panic("could not create SimulationStart completion\n");
+  }
+  SimulationWait = barrier_create("SimulationWait",NumThreads+1);
   if (SimulationWait == NULL) {
-    panic("could not create SimulationWait semaphore\n");
+    panic("could not create SimulationWait barrier\n");
   }
   heavy_direction = random()%4;
   /* initialization for synchronization code */
@@ -378,7 +379,8 @@ cleanup_state(void)
 {
   sem_destroy(mutex);
   sem_destroy(perf_mutex);
-  sem_destroy(SimulationWait);
+  completion_destroy(SimulationStart);
+  barrier_destroy(SimulationWait);
   intersection_sync_cleanup();
 }
 
@@ -432,6 +434,10 @@ vehicle_simulation(void * unusedpointer,
   (void) unusedpointer;
 
   KASSERT((long)thread_num < NumThreads);
+
+  /* wait for all of the simulation threads to be created */
+  completion_wait(SimulationStart);
+
   for(i=0;i<NumIterations;i++) {
 
     /* mix things up a bit: actual interarrival time is
@@ -514,7 +520,7 @@ vehicle_simulation(void * unusedpointer,
   }
 
   /* indicate that this simulation is finished */
-  V(SimulationWait); 
+  barrier_wait(SimulationWait);
 }
 
 
@@ -583,20 +589,21 @@ traffic_simulation(int nargs,
   /* initialize our simulation state */
   initialize_state();
 
-  /* get simulation start time */
-  gettime(&start_sec,&start_nsec);
-
   for (i = 0; i < NumThreads; i++) {
     error = thread_fork("vehicle_simulation thread", NULL, vehicle_simulation, NULL, i);
     if (error) {
       panic("traffic_simulation: thread_fork failed: %s\n", strerror(error));
     }
   }
+
+  /* get simulation start time */
+  gettime(&start_sec,&start_nsec);
+
+  /* let them all go */
+  complete_all(SimulationStart);
   
   /* wait for all of the vehicle simulations to finish before terminating */  
-  for(i=0;i<NumThreads;i++) {
-    P(SimulationWait);
-  }
+  barrier_wait(SimulationWait);
 
   /* get simulation end time */
   gettime(&end_sec,&end_nsec);
@@ -33,18 +33,26 @@
 #include <types.h>
 #include <lib.h>
 #include <thread.h>
+#include <synch.h>
 #include <test.h>
 
 #define NMATING 10
 
+/* Start and done for the whales (see synch.h). */
+static struct completion *whalestart;
+static struct barrier *whaledone;
+
 static
 void
 male(void *p, unsigned long which)
 {
 	(void)p;
+	completion_wait(whalestart);
 	kprintf("male whale #%ld starting\n", which);
 
 	// Implement this function 
+
+	barrier_wait(whaledone);
 }
 
 static
@@ -52,9 +60,12 @@ void
 female(void *p, unsigned long which)
 {
 	(void)p;
+	completion_wait(whalestart);
 	kprintf("female whale #%ld starting\n", which);
 
 	// Implement this function 
+
+	barrier_wait(whaledone);
 }
 
 static
@@ -62,9 +73,12 @@ void
 matchmaker(void *p, unsigned long which)
 {
 	(void)p;
+	completion_wait(whalestart);
 	kprintf("matchmaker whale #%ld starting\n", which);
 
 	// Implement this function 
+
+	barrier_wait(whaledone);
 }
 
 
@@ -78,6 +92,12 @@ whalemating(int nargs, char **args)
 	(void)nargs;
 	(void)args;
 
+	whalestart = completion_create("whalestart");
+	whaledone = barrier_create("whaledone", 3 * NMATING + 1);
+	if (whalestart == NULL || whaledone == NULL) {
+		panic("whalemating: out of memory\n");
+	}
+
 	for (i = 0; i < 3; i++) {
 		for (j = 0; j < NMATING; j++) {
 #ifdef UW
@@ -118,5 +138,10 @@ whalemating(int nargs, char **args)
 		}
 	}
 
+	complete_all(whalestart);
+	barrier_wait(whaledone);
+
+	completion_destroy(whalestart);
+	barrier_destroy(whaledone);
 	return 0;
 }
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+/*
+ * Futexes: sleeping and waking on an int in user memory, for user
+ * level locks and condition variables. Waiters are keyed on their
+ * address space and the user address. The keys hash into a fixed
+ * table of buckets; each bucket has a lock and a list of the futexes
+ * that currently have waiters. Each of those has a cv to sleep on.
+ * It's created by the first waiter and freed by the last one out.
+ *
+ * Checking the value and going to sleep happen under the bucket lock,
+ * which FUTEX_WAKE also takes, so a wakeup that follows a change to
+ * the value can't slip in between and get lost.
+ */
+
+#define FUTEX_NBUCKETS  64
+
+struct futex {
+	struct addrspace *fx_as;
+	vaddr_t fx_addr;
+	struct cv *fx_cv;
+	unsigned fx_nwaiting;		/* asleep and not yet woken */
+	unsigned fx_nthreads;		/* in futex_wait at all */
+	struct futex *fx_next;
+};
+
+struct futexbucket {
+	struct lock *fb_lock;
+	struct futex *fb_futexes;
+};
+
+static struct futexbucket futextable[FUTEX_NBUCKETS];
+
+/*
+ * Set up the bucket table. Called once during boot.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futextable[i].fb_lock = lock_create("futex");
+		if (futextable[i].fb_lock == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futextable[i].fb_futexes = NULL;
+	}
+}
+
+static
+struct futexbucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	unsigned h;
+
+	h = (addr >> 2) ^ ((uintptr_t)as >> 4);
+	h ^= h >> 11;
+	return &futextable[h % FUTEX_NBUCKETS];
+}
+
+/*
+ * Find the futex for (AS, ADDR) in bucket FB, or NULL.
+ */
+static
+struct futex *
+futex_find(struct futexbucket *fb, struct addrspace *as, vaddr_t addr)
+{
+	struct futex *fx;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+	for (fx = fb->fb_futexes; fx != NULL; fx = fx->fx_next) {
+		if (fx->fx_as == as && fx->fx_addr == addr) {
+			return fx;
+		}
+	}
+	return NULL;
+}
+
+static
+int
+futex_wait(struct addrspace *as, userptr_t uaddr, int val)
+{
+	struct proc *p = curproc;
+	struct futexbucket *fb;
+	struct futex *fx, **fxp;
+	int cur, result;
+
+	fb = futex_bucket(as, (vaddr_t)uaddr);
+	lock_acquire(fb->fb_lock);
+
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	/* Checked under the bucket lock; see futex_interrupt */
+	if (p->p_exiting) {
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	fx = futex_find(fb, as, (vaddr_t)uaddr);
+	if (fx == NULL) {
+		fx = kmalloc(sizeof(*fx));
+		if (fx == NULL) {
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		fx->fx_cv = cv_create("futex");
+		if (fx->fx_cv == NULL) {
+			kfree(fx);
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		fx->fx_as = as;
+		fx->fx_addr = (vaddr_t)uaddr;
+		fx->fx_nwaiting = 0;
+		fx->fx_nthreads = 0;
+		fx->fx_next = fb->fb_futexes;
+		fb->fb_futexes = fx;
+	}
+
+	/*
+	 * The cv is FIFO and FUTEX_WAKE signals it once per thread it
+	 * counts as woken, so when we come back we were woken (or
+	 * the process is exiting).
+	 */
+	fx->fx_nwaiting++;
+	fx->fx_nthreads++;
+	cv_wait(fx->fx_cv, fb->fb_lock);
+	fx->fx_nthreads--;
+
+	if (fx->fx_nthreads == 0) {
+		KASSERT(fx->fx_nwaiting == 0);
+		for (fxp = &fb->fb_futexes; *fxp != fx;
+		     fxp = &(*fxp)->fx_next) {
+			KASSERT(*fxp != NULL);
+		}
+		*fxp = fx->fx_next;
+		cv_destroy(fx->fx_cv);
+		kfree(fx);
+	}
+	lock_release(fb->fb_lock);
+
+	return p->p_exiting ? EINTR : 0;
+}
+
+static
+int
+futex_wake(struct addrspace *as, userptr_t uaddr, int val, int *retval)
+{
+	struct futexbucket *fb;
+	struct futex *fx;
+	int n = 0;
+
+	fb = futex_bucket(as, (vaddr_t)uaddr);
+	lock_acquire(fb->fb_lock);
+	fx = futex_find(fb, as, (vaddr_t)uaddr);
+	if (fx != NULL) {
+		while (n < val && fx->fx_nwaiting > 0) {
+			cv_signal(fx->fx_cv, fb->fb_lock);
+			fx->fx_nwaiting--;
+			n++;
+		}
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = n;
+	return 0;
+}
+
+/*
+ * Wake every thread of process P that's waiting on a futex, so it can
+ * notice the process is exiting. Called by uthread_exitall after
+ * setting p_exiting.
+ */
+void
+futex_interrupt(struct proc *p)
+{
+	struct futexbucket *fb;
+	struct futex *fx;
+	unsigned i;
+
+	KASSERT(p->p_exiting);
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futextable[i];
+		lock_acquire(fb->fb_lock);
+		for (fx = fb->fb_futexes; fx != NULL; fx = fx->fx_next) {
+			if (fx->fx_as == p->p_addrspace) {
+				cv_broadcast(fx->fx_cv, fb->fb_lock);
+				fx->fx_nwaiting = 0;
+			}
+		}
+		lock_release(fb->fb_lock);
+	}
+}
+
+/*
+ * futex system call.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, int *retval)
+{
+	struct addrspace *as;
+
+	if (((vaddr_t)uaddr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		*retval = 0;
+		return futex_wait(as, uaddr, val);
+	    case FUTEX_WAKE:
+		return futex_wake(as, uaddr, val, retval);
+	}
+	return EINVAL;
+}
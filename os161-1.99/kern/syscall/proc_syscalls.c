@@ -57,7 +57,7 @@ int sys_fork(struct trapframe *tf, int *retval) {
         return err;
     }
     // 4
-    struct procinfo *pi = procinfoarray_get_by_pid(procinfolist, child_proc->pid);
+    struct procinfo *pi = procinfo_lookup(child_proc->pid);
     pi->ppid = curproc->pid;
     // 5
     struct trapframe *ctf = (struct trapframe *)kmalloc(sizeof(struct trapframe));
@@ -89,12 +89,17 @@ void sys__exit(int exitcode) {
   /* for now, just include this to keep the compiler from complaining about
      an unused variable */
   (void)exitcode;
+
+  /* Make any other threads exit first; they share the address space */
+  uthread_exitall();
 #if OPT_A2
   if (!procinfolist_cv) { // lock is not using
       procinfolist_cv = cv_create("procinfolist_cv");
   }
   // take this look
   lock_acquire(procinfolist_lock);
+  // and this one, since we change the list
+  rwlock_acquire_write(procinfolist_rwlock);
 
   struct procinfo *pi = procinfoarray_get_by_pid(procinfolist, p->pid); // curr process procinfo
   pid_t pid = pi->pid;
@@ -102,6 +107,7 @@ void sys__exit(int exitcode) {
   if (ppid == -1) { //
       pi->state = EXITED;
       procinfoarray_remove_by_pid(procinfolist, pid); //把当前的pid从procinfoarray移除了
+      procinfo_retire(pi);
   } else {
       pi->exit_status = _MKWAIT_EXIT(exitcode);
       struct procinfo *pp = procinfoarray_get_by_pid(procinfolist, ppid); // parent proc info
@@ -111,6 +117,7 @@ void sys__exit(int exitcode) {
       } else {
           pi->state = EXITED;
           procinfoarray_remove_by_pid(procinfolist, pid);
+          procinfo_retire(pi);
       }
   }
   // cleanup zombine
@@ -121,10 +128,13 @@ void sys__exit(int exitcode) {
       if (pi->ppid == pid && pi->state == ZOMBIE) {
           pi->state = EXITED;
           procinfoarray_remove(procinfolist, i);
+          procinfo_retire(pi);
           break;
       }
   }
+  procinfo_publish();
 
+  rwlock_release_write(procinfolist_rwlock);
   lock_release(procinfolist_lock);
 #endif
 
@@ -201,9 +211,19 @@ sys_waitpid(pid_t pid,
 
   lock_acquire(procinfolist_lock);
 
-  struct procinfo *wait_proc = procinfoarray_get_by_pid(procinfolist, pid);
+  struct procinfo *wait_proc = procinfo_lookup(pid);
+  if (wait_proc == NULL) {
+      lock_release(procinfolist_lock);
+      return ESRCH;
+  }
   while (RUNNING == wait_proc->state) {
       cv_wait(procinfolist_cv, procinfolist_lock);
+      // it may have been reaped (and freed) while we slept
+      wait_proc = procinfo_lookup(pid);
+      if (wait_proc == NULL) {
+          lock_release(procinfolist_lock);
+          return ESRCH;
+      }
   }
   exitstatus = wait_proc->exit_status;
 
@@ -237,6 +257,9 @@ int sys_execv(struct trapframe *tf, int *retval) {
     char *progname = (char *)(tf->tf_a0);
     char **arglist = (char **)(tf->tf_a1);
 
+    // other threads can't survive the address space being replaced
+    uthread_exitall();
+
     // 1
     int argc = 0;
     for (; arglist[argc]!=NULL; ++argc) { }
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <copyinout.h>
+#include <clock.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+/*
+ * Scheduling-related system calls.
+ */
+
+/*
+ * Restrict the calling thread to the cpus in MASK.
+ */
+int
+sys_setaffinity(uint32_t mask)
+{
+	return thread_setaffinity(mask);
+}
+
+/*
+ * Return the calling thread's cpu mask.
+ */
+int
+sys_getaffinity(userptr_t user_mask_ptr)
+{
+	uint32_t mask;
+
+	mask = thread_getaffinity();
+	return copyout(&mask, user_mask_ptr, sizeof(uint32_t));
+}
+
+/*
+ * Set the calling process's share of the cpu.
+ */
+int
+sys_settickets(int tickets)
+{
+	if (tickets < 1) {
+		return EINVAL;
+	}
+	return thread_settickets(tickets);
+}
+
+/*
+ * Convert nanoseconds to a struct timeval.
+ */
+static
+void
+nsecs_to_timeval(uint64_t nsecs, struct timeval *tv)
+{
+	tv->tv_sec = nsecs / 1000000000;
+	tv->tv_usec = (nsecs % 1000000000) / 1000;
+}
+
+/*
+ * Report resource usage for the calling process. Only the scheduling
+ * fields are filled in; cpu time is counted in hardclock ticks and
+ * isn't split between user and system, so it all goes in ru_utime.
+ * Usage of children isn't tracked.
+ */
+int
+sys_getrusage(int who, userptr_t user_rusage_ptr)
+{
+	struct rusage ru;
+	struct schedstats ss;
+
+	if (who != RUSAGE_SELF) {
+		return EINVAL;
+	}
+
+	proc_getstats(curproc, &ss);
+
+	bzero(&ru, sizeof(ru));
+	nsecs_to_timeval((uint64_t)ss.ss_runticks * (1000000000 / HZ),
+			 &ru.ru_utime);
+	ru.ru_nvcsw = ss.ss_nvcsw;
+	ru.ru_nivcsw = ss.ss_nivcsw;
+	nsecs_to_timeval(ss.ss_readywait, &ru.ru_waittime);
+	nsecs_to_timeval(ss.ss_sleeptime, &ru.ru_sleeptime);
+	ru.ru_nmigrations = ss.ss_migrations;
+
+	return copyout(&ru, user_rusage_ptr, sizeof(ru));
+}
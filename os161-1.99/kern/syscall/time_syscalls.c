@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,40 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for the time in REQ. There are no signals to
+ * interrupt the sleep, so if REM is given the time remaining is
+ * always zero. The only interruption is another thread exiting the
+ * process, and then we never get back to user mode.
+ */
+int
+sys_nanosleep(userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	result = clocknanosleep((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+	if (result) {
+		/* The process is exiting; nobody will look at REM */
+		return result;
+	}
+
+	if (rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
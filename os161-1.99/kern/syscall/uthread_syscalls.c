@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+#include <clock.h>
+#include <generic/console.h>
+
+/*
+ * Multithreaded user processes.
+ *
+ * __thread_create starts a new thread in the caller's process, which
+ * calls a user function on a user-supplied stack. Each such thread
+ * gets a thread id, and a struct uthread on the process's p_uthreads
+ * list that holds its exit status until somebody thread_joins it.
+ *
+ * When the process exits (or execs, or takes a fatal fault), its
+ * other threads are made to exit the next time they head back to
+ * user mode, and the exiting thread waits for them before tearing
+ * the process down. Threads blocked in the kernel are woken to
+ * notice if they're in thread_join, a futex wait, nanosleep (or
+ * anything else built on clocknanosleep), or a console read.
+ *
+ * Other kernel sleeps are not interrupted: a thread waiting for a
+ * lock, in waitpid for a child that hasn't exited, or for console
+ * input behind another process's reader holds up _exit and execv
+ * until that wait finishes on its own.
+ */
+
+/* What the new thread needs to get started */
+struct uthread_start {
+	vaddr_t us_entry;
+	vaddr_t us_arg;
+	vaddr_t us_stack;
+	vaddr_t us_gp;
+	int us_tid;
+};
+
+/*
+ * Count the threads in a process.
+ */
+static
+unsigned
+uthread_count(struct proc *p)
+{
+	unsigned num;
+
+	spinlock_acquire(&p->p_lock);
+	num = threadarray_num(&p->p_threads);
+	spinlock_release(&p->p_lock);
+	return num;
+}
+
+/*
+ * Find the record for thread TID. Returns a pointer to the link that
+ * points to it, so it can be unlinked, or NULL.
+ */
+static
+struct uthread **
+uthread_find(struct proc *p, int tid)
+{
+	struct uthread **utp;
+
+	KASSERT(lock_do_i_hold(p->p_threadlock));
+	for (utp = &p->p_uthreads; *utp != NULL; utp = &(*utp)->ut_next) {
+		if ((*utp)->ut_tid == tid) {
+			return utp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Exit the current thread with status STATUS. If it's the last
+ * thread in the process, the process exits too.
+ */
+static
+void
+uthread_die(int status)
+{
+	struct proc *p = curproc;
+	struct uthread **utp;
+
+	lock_acquire(p->p_threadlock);
+
+	utp = uthread_find(p, curthread->t_tid);
+	if (utp != NULL) {
+		(*utp)->ut_exited = true;
+		(*utp)->ut_status = status;
+	}
+
+	if (uthread_count(p) == 1) {
+		/* Last one out ends the process. */
+		lock_release(p->p_threadlock);
+		sys__exit(status);
+		panic("uthread_die: sys__exit returned\n");
+	}
+
+	proc_remthread(curthread);
+	cv_broadcast(p->p_threadcv, p->p_threadlock);
+	lock_release(p->p_threadlock);
+
+	thread_exit();
+}
+
+/*
+ * Where new threads start: in the kernel, on their way to user mode.
+ */
+static
+void
+uthread_start(void *data1, unsigned long data2)
+{
+	struct uthread_start *us = data1;
+	vaddr_t entry, arg, stack, gp;
+
+	(void)data2;
+
+	curthread->t_tid = us->us_tid;
+	entry = us->us_entry;
+	arg = us->us_arg;
+	stack = us->us_stack;
+	gp = us->us_gp;
+	kfree(us);
+
+	/* Don't bother starting if the process is on its way out. */
+	uthread_checkexit();
+
+	enter_new_thread((userptr_t)arg, stack, entry, gp);
+}
+
+/*
+ * Create a thread that calls ENTRY(ARG) on the stack whose top is
+ * STACK. GP is the caller's global pointer; the new thread needs the
+ * same one to reach the program's small data, and crt0 only sets it
+ * up in the first thread. Returns its thread id.
+ */
+int
+sys___thread_create(userptr_t entry, userptr_t arg, userptr_t stack,
+		    vaddr_t gp, int *retval)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+	struct uthread_start *us;
+	int tid, result;
+
+	if (entry == NULL || stack == NULL) {
+		return EINVAL;
+	}
+
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	us = kmalloc(sizeof(*us));
+	if (us == NULL) {
+		kfree(ut);
+		return ENOMEM;
+	}
+
+	lock_acquire(p->p_threadlock);
+	if (p->p_exiting) {
+		lock_release(p->p_threadlock);
+		kfree(us);
+		kfree(ut);
+		return EINTR;
+	}
+	tid = p->p_nexttid++;
+	ut->ut_tid = tid;
+	ut->ut_exited = false;
+	ut->ut_status = 0;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+	lock_release(p->p_threadlock);
+
+	us->us_entry = (vaddr_t)entry;
+	us->us_arg = (vaddr_t)arg;
+	/* The MIPS calling convention wants 8-byte alignment */
+	us->us_stack = (vaddr_t)stack & ~(vaddr_t)7;
+	us->us_gp = gp;
+	us->us_tid = tid;
+
+	result = thread_fork(p->p_name, p, uthread_start, us, 0);
+	if (result) {
+		lock_acquire(p->p_threadlock);
+		*uthread_find(p, tid) = ut->ut_next;
+		lock_release(p->p_threadlock);
+		kfree(us);
+		kfree(ut);
+		return result;
+	}
+
+	/* US (and perhaps UT) belong to the new thread now */
+	*retval = tid;
+	return 0;
+}
+
+/*
+ * Exit the calling thread.
+ */
+void
+sys_thread_exit(int status)
+{
+	uthread_die(status);
+}
+
+/*
+ * Wait for thread TID to exit and collect its exit status. Each
+ * thread can be joined only once.
+ */
+int
+sys_thread_join(int tid, userptr_t user_status)
+{
+	struct proc *p = curproc;
+	struct uthread **utp, *ut;
+	int status;
+
+	if (tid == curthread->t_tid) {
+		return EINVAL;
+	}
+
+	lock_acquire(p->p_threadlock);
+	while (1) {
+		/* Look it up each time; another joiner may have freed it */
+		utp = uthread_find(p, tid);
+		if (utp == NULL) {
+			lock_release(p->p_threadlock);
+			return ESRCH;
+		}
+		if ((*utp)->ut_exited) {
+			break;
+		}
+		if (p->p_exiting) {
+			lock_release(p->p_threadlock);
+			return EINTR;
+		}
+		cv_wait(p->p_threadcv, p->p_threadlock);
+	}
+	ut = *utp;
+	*utp = ut->ut_next;
+	status = ut->ut_status;
+	lock_release(p->p_threadlock);
+	kfree(ut);
+
+	if (user_status != NULL) {
+		return copyout(&status, user_status, sizeof(int));
+	}
+	return 0;
+}
+
+/*
+ * Is the current thread's process exiting? For interruptible sleeps,
+ * which check this with their sleep lock held, so they can't miss
+ * the wakeup uthread_exitall sends after setting p_exiting.
+ */
+bool
+uthread_exiting(void)
+{
+	struct proc *p = curproc;
+
+	/* Unlocked peek; p_exiting only goes false when we're alone */
+	return p != NULL && p != kproc && p->p_exiting;
+}
+
+/*
+ * Called on the way back to user mode: if the process is exiting,
+ * don't go.
+ */
+void
+uthread_checkexit(void)
+{
+	if (uthread_exiting()) {
+		uthread_die(-1);
+	}
+}
+
+/*
+ * Make every other thread in the current process exit, and wait until
+ * they have. Used by _exit, execv, and when killing a process after a
+ * fatal fault. If another thread is already doing this, just exit.
+ */
+void
+uthread_exitall(void)
+{
+	struct proc *p = curproc;
+
+	lock_acquire(p->p_threadlock);
+	if (p->p_exiting) {
+		lock_release(p->p_threadlock);
+		uthread_die(-1);
+	}
+	p->p_exiting = true;
+	cv_broadcast(p->p_threadcv, p->p_threadlock);
+	futex_interrupt(p);
+	clocksleep_interrupt();
+	con_interrupt();
+	while (uthread_count(p) > 1) {
+		cv_wait(p->p_threadcv, p->p_threadlock);
+	}
+	/* We're alone now, so it's safe to let threads be created again */
+	p->p_exiting = false;
+	lock_release(p->p_threadlock);
+}
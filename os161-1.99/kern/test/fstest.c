@@ -43,6 +43,8 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <cpu.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vfs.h>
@@ -579,6 +581,101 @@ DEFTEST(createstress);
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Path lookup benchmark: each worker (see sb_forkon) looks up the
+ * same path over and over, dropping the reference each time, and we
+ * report lookups per millisecond. Every lookup takes and drops a
+ * reference on each vnode along the path, starting with the root or
+ * current directory, so a short path on a busy mount mostly measures
+ * how those reference counts hold up when all cpus share them.
+ */
+
+#define LOOKUP_ITERS  2000
+
+static const char *lookup_path;
+static unsigned lookup_iters;
+static volatile int lookup_errors;
+
+static
+void
+lookupbench_thread(void *junk, unsigned long num)
+{
+	char *path;
+	struct vnode *vn;
+	unsigned i;
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	/* vfs_lookup needs a copy it can scribble on */
+	path = kmalloc(strlen(lookup_path) + 1);
+	if (path == NULL) {
+		lookup_errors = ENOMEM;
+		V(sb_done);
+		return;
+	}
+	for (i=0; i<lookup_iters; i++) {
+		strcpy(path, lookup_path);
+		result = vfs_lookup(path, &vn);
+		if (result) {
+			lookup_errors = result;
+			break;
+		}
+		VOP_DECREF(vn);
+	}
+	kfree(path);
+	V(sb_done);
+}
+
+int
+lookupbench(int nargs, char **args)
+{
+	unsigned i, ncpus, maxcpus;
+	uint64_t start;
+	int iters;
+
+	iters = LOOKUP_ITERS;
+	if (nargs == 3) {
+		iters = atoi(args[2]);
+	}
+	if (nargs < 2 || nargs > 3 || iters <= 0) {
+		kprintf("Usage: fs6 path [iterations]\n");
+		return EINVAL;
+	}
+	lookup_path = args[1];
+	lookup_iters = iters;
+
+	sb_init();
+	maxcpus = cpu_count();
+
+	kprintf("*** Starting path lookup benchmark on %s\n", lookup_path);
+	kprintf("%5s %12s\n", "cpus", "lookups/ms");
+	for (ncpus = 1; ncpus <= 8 && ncpus <= maxcpus; ncpus *= 2) {
+		lookup_errors = 0;
+		start = clock_nsecs();
+		for (i=0; i<ncpus; i++) {
+			sb_forkon("lookupbench", lookupbench_thread, i, i);
+		}
+		for (i=0; i<ncpus; i++) {
+			P(sb_done);
+		}
+		if (lookup_errors) {
+			kprintf("lookupbench: %s: %s\n", lookup_path,
+				strerror(lookup_errors));
+			return lookup_errors;
+		}
+		kprintf("%5u %12u\n", ncpus,
+			sb_rate((uint64_t)ncpus * lookup_iters,
+				clock_nsecs() - start));
+	}
+
+	kprintf("*** Path lookup benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
 int
 printfile(int nargs, char **args)
 {
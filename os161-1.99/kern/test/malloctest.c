@@ -31,7 +31,9 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -137,3 +139,117 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * kmalloc throughput benchmark.
+ *
+ * Each thread repeatedly allocates a small batch of blocks of assorted
+ * subpage sizes and frees them again, which is the pattern that
+ * kmalloc's per-cpu magazines are meant to absorb. We run with 1, 2,
+ * 4, and 8 threads (or just the count given on the command line) and
+ * report the aggregate rate, so running it on configurations with
+ * different numbers of cpus shows how well kmalloc scales.
+ */
+
+#define KM3_ITERS  2000
+#define KM3_BATCH  8
+
+static const size_t km3sizes[KM3_BATCH] = {
+	16, 24, 40, 64, 100, 200, 400, 1000
+};
+
+static
+void
+km3thread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	void *ptrs[KM3_BATCH];
+	int i, j;
+
+	for (i=0; i<KM3_ITERS; i++) {
+		for (j=0; j<KM3_BATCH; j++) {
+			ptrs[j] = kmalloc(km3sizes[(i+j) % KM3_BATCH]);
+			if (ptrs[j] == NULL) {
+				panic("km3: thread %lu: kmalloc returned NULL\n",
+				      num);
+			}
+		}
+		for (j=0; j<KM3_BATCH; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+	V(sem);
+}
+
+static
+void
+km3run(struct semaphore *sem, int nthreads)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long ops, msecs;
+	int i, result;
+
+	gettime(&beforesecs, &beforensecs);
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("km3", NULL, km3thread, sem, i);
+		if (result) {
+			panic("km3: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(sem);
+	}
+
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	ops = (unsigned long)nthreads * KM3_ITERS * KM3_BATCH * 2;
+	msecs = secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	kprintf("km3: %d threads: %lu ops in %lu.%09lu sec (%lu ops/sec)\n",
+		nthreads, ops, (unsigned long)secs, (unsigned long)nsecs,
+		ops * 1000 / msecs);
+}
+
+int
+mallocthroughput(int nargs, char **args)
+{
+	struct semaphore *sem;
+	int nthreads;
+
+	if (nargs > 2) {
+		kprintf("Usage: km3 [threads]\n");
+		return EINVAL;
+	}
+
+	sem = sem_create("km3", 0);
+	if (sem == NULL) {
+		panic("km3: sem_create failed\n");
+	}
+
+	kprintf("Starting kmalloc throughput test...\n");
+
+	if (nargs == 2) {
+		nthreads = atoi(args[1]);
+		if (nthreads <= 0) {
+			nthreads = 1;
+		}
+		km3run(sem, nthreads);
+	}
+	else {
+		for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+			km3run(sem, nthreads);
+		}
+	}
+
+	sem_destroy(sem);
+	kprintf("kmalloc throughput test done\n");
+
+	return 0;
+}
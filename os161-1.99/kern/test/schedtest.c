@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler tests.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <test.h>
+
+/*
+ * Wakeup latency test.
+ *
+ * A number of hog threads spin, using all the CPU they can get, while
+ * a pair of threads pass a token back and forth. Each round the waker
+ * naps for a tick, stamps the time, and signals the waiter; the
+ * waiter records how long it took from the signal until it actually
+ * got to run. With a round-robin scheduler the waiter has to wait for
+ * the hogs ahead of it in the run queue; with the feedback queue it
+ * should go straight to the front.
+ */
+
+#define SC1_ROUNDS  100
+#define SC1_HOGS    4
+
+static volatile bool sc1_stop;
+static struct semaphore *sc1_wake;
+static struct semaphore *sc1_ack;
+static struct semaphore *sc1_done;
+static time_t sc1_stampsecs;
+static uint32_t sc1_stampnsecs;
+static uint32_t sc1_min, sc1_max;
+static uint32_t sc1_total;
+
+static
+void
+sc1hog(void *junk, unsigned long num)
+{
+	volatile unsigned long count = 0;
+
+	(void)junk;
+	(void)num;
+
+	while (!sc1_stop) {
+		count++;
+	}
+	V(sc1_done);
+}
+
+static
+void
+sc1waker(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<SC1_ROUNDS; i++) {
+		clocknap(1);
+		gettime(&sc1_stampsecs, &sc1_stampnsecs);
+		V(sc1_wake);
+		P(sc1_ack);
+	}
+	V(sc1_done);
+}
+
+static
+void
+sc1waiter(void *junk, unsigned long num)
+{
+	time_t nowsecs, secs;
+	uint32_t nownsecs, nsecs, usecs;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<SC1_ROUNDS; i++) {
+		P(sc1_wake);
+		gettime(&nowsecs, &nownsecs);
+		getinterval(sc1_stampsecs, sc1_stampnsecs, nowsecs, nownsecs,
+			    &secs, &nsecs);
+		usecs = secs * 1000000 + nsecs / 1000;
+		if (usecs < sc1_min) {
+			sc1_min = usecs;
+		}
+		if (usecs > sc1_max) {
+			sc1_max = usecs;
+		}
+		sc1_total += usecs;
+		V(sc1_ack);
+	}
+	V(sc1_done);
+}
+
+int
+schedlatencytest(int nargs, char **args)
+{
+	int i, nhogs, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: sc1 [hogs]\n");
+		return EINVAL;
+	}
+	nhogs = SC1_HOGS;
+	if (nargs == 2) {
+		nhogs = atoi(args[1]);
+		if (nhogs < 0) {
+			nhogs = 0;
+		}
+	}
+
+	sc1_wake = sem_create("sc1_wake", 0);
+	sc1_ack = sem_create("sc1_ack", 0);
+	sc1_done = sem_create("sc1_done", 0);
+	if (sc1_wake == NULL || sc1_ack == NULL || sc1_done == NULL) {
+		panic("sc1: sem_create failed\n");
+	}
+	sc1_stop = false;
+	sc1_min = (uint32_t)-1;
+	sc1_max = 0;
+	sc1_total = 0;
+
+	kprintf("Starting scheduler latency test with %d hogs...\n", nhogs);
+
+	for (i=0; i<nhogs; i++) {
+		result = thread_fork("sc1_hog", NULL, sc1hog, NULL, i);
+		if (result) {
+			panic("sc1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("sc1_waiter", NULL, sc1waiter, NULL, 0);
+	if (result) {
+		panic("sc1: thread_fork failed: %s\n", strerror(result));
+	}
+	result = thread_fork("sc1_waker", NULL, sc1waker, NULL, 0);
+	if (result) {
+		panic("sc1: thread_fork failed: %s\n", strerror(result));
+	}
+
+	/* Wait for the waker and waiter, then stop the hogs. */
+	P(sc1_done);
+	P(sc1_done);
+	sc1_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(sc1_done);
+	}
+
+	kprintf("sc1: %d hogs: wakeup latency min %u avg %u max %u usec\n",
+		nhogs, sc1_min, sc1_total / SC1_ROUNDS, sc1_max);
+
+	sem_destroy(sc1_wake);
+	sem_destroy(sc1_ack);
+	sem_destroy(sc1_done);
+	kprintf("Scheduler latency test done\n");
+
+	return 0;
+}
+
+/*
+ * Proportional share test.
+ *
+ * Makes one kernel-only process per ticket count given (default 100,
+ * 200, and 300), each with a single hog thread, and pins them all to
+ * the current cpu so they have to compete for it. After a few seconds
+ * we compare how much work each one got done against its share of
+ * the tickets.
+ */
+
+#define SC2_MAXPROCS  8
+#define SC2_SECONDS   5
+
+struct sc2proc {
+	struct proc *sp_proc;
+	unsigned sp_tickets;
+	volatile unsigned long sp_count;
+};
+
+static struct sc2proc sc2procs[SC2_MAXPROCS];
+static volatile bool sc2_go, sc2_stop;
+static struct semaphore *sc2_done;
+
+static
+void
+sc2hog(void *junk, unsigned long num)
+{
+	struct sc2proc *sp = &sc2procs[num];
+	int result;
+
+	(void)junk;
+
+	result = thread_settickets(sp->sp_tickets);
+	if (result) {
+		panic("sc2: thread_settickets: %s\n", strerror(result));
+	}
+
+	while (!sc2_stop) {
+		if (sc2_go) {
+			sp->sp_count++;
+		}
+	}
+
+	/* Kernel threads of other processes must detach themselves. */
+	proc_remthread(curthread);
+	V(sc2_done);
+}
+
+int
+schedsharetest(int nargs, char **args)
+{
+	static const unsigned deftickets[] = { 100, 200, 300 };
+	uint32_t oldmask;
+	uint64_t total;
+	unsigned i, nprocs, totaltickets, share, expected;
+	char name[16];
+	int result;
+
+	if (nargs > SC2_MAXPROCS + 1) {
+		kprintf("Usage: sc2 [tickets ...]\n");
+		return EINVAL;
+	}
+
+	if (nargs > 1) {
+		nprocs = nargs - 1;
+		for (i=0; i<nprocs; i++) {
+			sc2procs[i].sp_tickets = atoi(args[i+1]);
+			if (sc2procs[i].sp_tickets < 1 ||
+			    sc2procs[i].sp_tickets > PROC_MAXTICKETS) {
+				kprintf("sc2: tickets must be between 1 and %u\n",
+					PROC_MAXTICKETS);
+				return EINVAL;
+			}
+		}
+	}
+	else {
+		nprocs = sizeof(deftickets) / sizeof(deftickets[0]);
+		for (i=0; i<nprocs; i++) {
+			sc2procs[i].sp_tickets = deftickets[i];
+		}
+	}
+
+	sc2_done = sem_create("sc2_done", 0);
+	if (sc2_done == NULL) {
+		panic("sc2: sem_create failed\n");
+	}
+	sc2_go = sc2_stop = false;
+
+	kprintf("Starting proportional share test on cpu %u...\n",
+		curcpu->c_number);
+
+	/* The hogs inherit our affinity; pin it to this cpu. */
+	oldmask = thread_getaffinity();
+	result = thread_setaffinity((uint32_t)1 << curcpu->c_number);
+	KASSERT(result == 0);
+
+	for (i=0; i<nprocs; i++) {
+		snprintf(name, sizeof(name), "sc2_%u", i);
+		sc2procs[i].sp_proc = proc_create_kernel(name);
+		if (sc2procs[i].sp_proc == NULL) {
+			panic("sc2: proc_create_kernel failed\n");
+		}
+		sc2procs[i].sp_count = 0;
+		result = thread_fork(name, sc2procs[i].sp_proc, sc2hog,
+				     NULL, i);
+		if (result) {
+			panic("sc2: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	sc2_go = true;
+	clocksleep(SC2_SECONDS);
+	sc2_stop = true;
+
+	for (i=0; i<nprocs; i++) {
+		P(sc2_done);
+	}
+	thread_setaffinity(oldmask);
+
+	total = 0;
+	totaltickets = 0;
+	for (i=0; i<nprocs; i++) {
+		total += sc2procs[i].sp_count;
+		totaltickets += sc2procs[i].sp_tickets;
+	}
+	if (total == 0) {
+		total = 1;
+	}
+
+	for (i=0; i<nprocs; i++) {
+		/* tenths of a percent */
+		share = sc2procs[i].sp_count * (uint64_t)1000 / total;
+		expected = sc2procs[i].sp_tickets * 1000 / totaltickets;
+		kprintf("sc2: proc %u: %5u tickets: %u.%u%% of cpu "
+			"(expected %u.%u%%)\n", i, sc2procs[i].sp_tickets,
+			share / 10, share % 10, expected / 10, expected % 10);
+		proc_destroy(sc2procs[i].sp_proc);
+		sc2procs[i].sp_proc = NULL;
+	}
+
+	sem_destroy(sc2_done);
+	kprintf("Proportional share test done\n");
+
+	return 0;
+}
+
+/*
+ * Priority inversion test.
+ *
+ * Everything is pinned to one cpu. Each round a low-priority thread
+ * takes a lock and does a fixed amount of work holding it, while a
+ * high-priority thread (one that mostly sleeps) waits for the lock
+ * and a few hogs compete for the cpu. The low thread has burned
+ * through its quanta and sits at the bottom level with the hogs, so
+ * without inheritance the high thread waits for all the hogs' turns
+ * as well as the work; with it, the low thread runs at the waiter's
+ * level and the wait should come down to about the work itself. Run
+ * once with lock_inheritance off and once with it on, and report how
+ * long the high thread waited for the lock.
+ */
+
+#define SC3_ROUNDS  20
+#define SC3_HOGS    3
+#define SC3_HOLDMS  30		/* cpu time the low thread holds the lock */
+
+static volatile bool sc3_stop;
+static struct lock *sc3_lock;
+static struct semaphore *sc3_held;
+static struct semaphore *sc3_next;
+static struct semaphore *sc3_done;
+static unsigned long sc3_loopsperms;
+static uint64_t sc3_min, sc3_max, sc3_total;
+
+/* Burn LOOPS iterations of cpu. */
+static
+void
+sc3spin(unsigned long loops)
+{
+	volatile unsigned long i;
+
+	for (i=0; i<loops; i++) {
+		/* nothing */
+	}
+}
+
+static
+void
+sc3hog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!sc3_stop) {
+		sc3spin(1000);
+	}
+	V(sc3_done);
+}
+
+static
+void
+sc3low(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<SC3_ROUNDS; i++) {
+		lock_acquire(sc3_lock);
+		V(sc3_held);
+		sc3spin(sc3_loopsperms * SC3_HOLDMS);
+		lock_release(sc3_lock);
+		P(sc3_next);
+	}
+	V(sc3_done);
+}
+
+static
+void
+sc3high(void *junk, unsigned long num)
+{
+	uint64_t start, wait;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<SC3_ROUNDS; i++) {
+		P(sc3_held);
+		start = clock_nsecs();
+		lock_acquire(sc3_lock);
+		wait = clock_nsecs() - start;
+		lock_release(sc3_lock);
+
+		if (wait < sc3_min) {
+			sc3_min = wait;
+		}
+		if (wait > sc3_max) {
+			sc3_max = wait;
+		}
+		sc3_total += wait;
+		V(sc3_next);
+	}
+	V(sc3_done);
+}
+
+static
+void
+sc3fork(const char *name, void (*func)(void *, unsigned long))
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, 0);
+	if (result) {
+		panic("sc3: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Do SC3_ROUNDS rounds with inheritance on or off.
+ */
+static
+void
+sc3run(bool inherit, int nhogs)
+{
+	int i;
+
+	lock_inheritance = inherit;
+	sc3_stop = false;
+	sc3_min = (uint64_t)-1;
+	sc3_max = 0;
+	sc3_total = 0;
+
+	for (i=0; i<nhogs; i++) {
+		sc3fork("sc3_hog", sc3hog);
+	}
+	sc3fork("sc3_low", sc3low);
+	sc3fork("sc3_high", sc3high);
+
+	/* Wait for the low and high threads, then stop the hogs. */
+	P(sc3_done);
+	P(sc3_done);
+	sc3_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(sc3_done);
+	}
+
+	kprintf("sc3: inheritance %-3s: lock wait min %llu avg %llu "
+		"max %llu usec\n", inherit ? "on" : "off",
+		(unsigned long long)(sc3_min / 1000),
+		(unsigned long long)(sc3_total / SC3_ROUNDS / 1000),
+		(unsigned long long)(sc3_max / 1000));
+}
+
+int
+schedinversiontest(int nargs, char **args)
+{
+	uint32_t oldmask;
+	uint64_t start;
+	unsigned long loops;
+	bool savedinherit;
+	int nhogs, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: sc3 [hogs]\n");
+		return EINVAL;
+	}
+	nhogs = SC3_HOGS;
+	if (nargs == 2) {
+		nhogs = atoi(args[1]);
+		if (nhogs < 0) {
+			nhogs = 0;
+		}
+	}
+
+	sc3_lock = lock_create("sc3_lock");
+	sc3_held = sem_create("sc3_held", 0);
+	sc3_next = sem_create("sc3_next", 0);
+	sc3_done = sem_create("sc3_done", 0);
+	if (sc3_lock == NULL || sc3_held == NULL || sc3_next == NULL ||
+	    sc3_done == NULL) {
+		panic("sc3: out of memory\n");
+	}
+	savedinherit = lock_inheritance;
+
+	/* The threads inherit our affinity; pin it to this cpu. */
+	oldmask = thread_getaffinity();
+	result = thread_setaffinity((uint32_t)1 << curcpu->c_number);
+	KASSERT(result == 0);
+
+	/* Find out roughly how much spinning makes a millisecond. */
+	loops = 0;
+	start = clock_nsecs();
+	while (clock_nsecs() - start < 10 * 1000000) {
+		sc3spin(1000);
+		loops += 1000;
+	}
+	sc3_loopsperms = loops / 10;
+
+	kprintf("Starting priority inversion test on cpu %u with %d hogs "
+		"(lock held for %u ms)...\n", curcpu->c_number, nhogs,
+		SC3_HOLDMS);
+	sc3run(false, nhogs);
+	sc3run(true, nhogs);
+
+	thread_setaffinity(oldmask);
+	lock_inheritance = savedinherit;
+	sem_destroy(sc3_done);
+	sem_destroy(sc3_next);
+	sem_destroy(sc3_held);
+	lock_destroy(sc3_lock);
+	kprintf("Priority inversion test done\n");
+
+	return 0;
+}
+
+/*
+ * Affinity test.
+ *
+ * Pin the current thread to each cpu in turn, in both directions, and
+ * check after each thread_setaffinity call that we're already running
+ * on the cpu we asked for, and still are after yielding a few times.
+ */
+
+#define SC4_ROUNDS  10
+#define SC4_YIELDS  5
+
+static
+unsigned
+sc4check(unsigned want, const char *when)
+{
+	if (curcpu->c_number != want) {
+		kprintf("sc4: on cpu %u %s pinning to cpu %u\n",
+			curcpu->c_number, when, want);
+		return 1;
+	}
+	return 0;
+}
+
+int
+schedaffinitytest(int nargs, char **args)
+{
+	uint32_t oldmask;
+	unsigned i, j, round, cpu, numcpus, bad;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	numcpus = cpu_count();
+	if (numcpus > 32) {
+		numcpus = 32;
+	}
+	oldmask = thread_getaffinity();
+	bad = 0;
+
+	kprintf("Starting affinity test on %u cpus...\n", numcpus);
+	for (round=0; round<SC4_ROUNDS; round++) {
+		for (i=0; i<2 * numcpus; i++) {
+			cpu = i < numcpus ? i : 2 * numcpus - 1 - i;
+			result = thread_setaffinity((uint32_t)1 << cpu);
+			KASSERT(result == 0);
+			bad += sc4check(cpu, "right after");
+			for (j=0; j<SC4_YIELDS; j++) {
+				thread_yield();
+			}
+			bad += sc4check(cpu, "after yielding since");
+		}
+	}
+	thread_setaffinity(oldmask);
+
+	if (bad > 0) {
+		kprintf("Affinity test FAILED (%u wrong cpus)\n", bad);
+		return EINVAL;
+	}
+	kprintf("Affinity test done\n");
+	return 0;
+}
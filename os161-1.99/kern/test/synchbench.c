@@ -0,0 +1,992 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Synchronization benchmarks.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <proc.h>
+#include <rcu.h>
+#include <limits.h>
+#include <test.h>
+#include "opt-ticketlock.h"
+
+/*
+ * Helpers shared by the benchmarks, here and in fstest.c. The scaling
+ * benchmarks fork one worker per cpu with sb_forkon, for 1, 2, 4, and
+ * 8 cpus (as many as there are), and each worker Vs sb_done when it
+ * finishes. sb_init creates sb_done the first time.
+ */
+struct semaphore *sb_done;
+
+void
+sb_init(void)
+{
+	if (sb_done == NULL) {
+		sb_done = sem_create("sb_done", 0);
+		if (sb_done == NULL) {
+			panic("synchbench: sem_create failed\n");
+		}
+	}
+}
+
+static
+void
+sb_fork(const char *name, void (*func)(void *, unsigned long),
+	unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("%s: thread_fork failed: %s\n", name, strerror(result));
+	}
+}
+
+/*
+ * Fork a thread that runs only on cpu CPU. Threads inherit their
+ * creator's affinity, so set ours for the duration.
+ */
+void
+sb_forkon(const char *name, void (*func)(void *, unsigned long),
+	  unsigned long num, unsigned cpu)
+{
+	uint32_t oldmask;
+	int result;
+
+	oldmask = thread_getaffinity();
+	result = thread_setaffinity((uint32_t)1 << cpu);
+	KASSERT(result == 0);
+	sb_fork(name, func, num);
+	thread_setaffinity(oldmask);
+}
+
+/* Operations per millisecond, for NOPS operations in NSECS nanoseconds. */
+unsigned
+sb_rate(uint64_t nops, uint64_t nsecs)
+{
+	if (nsecs == 0) {
+		return 0;
+	}
+	return (unsigned)(nops * 1000000 / nsecs);
+}
+
+////////////////////////////////////////////////////////////
+// sb1: cv_broadcast
+
+/*
+ * A crowd of threads waits on a cv; each round the main thread waits
+ * for all of them to be asleep, then wakes them all with one
+ * cv_broadcast. Reports the time per round (the broadcast plus every
+ * waiter running and going back to sleep) and the time spent in
+ * cv_broadcast itself, which is mostly wchan_wakeall putting the
+ * waiters on run queues.
+ */
+
+#define SB1_WAITERS  64
+#define SB1_ROUNDS   500
+
+static struct lock *sb1_lock;
+static struct cv *sb1_cv;		/* waiters wait here */
+static struct cv *sb1_readycv;		/* main thread waits here */
+static unsigned sb1_gen;		/* bumped for each broadcast */
+static unsigned sb1_nwaiting;
+static unsigned sb1_nwaiters;
+static bool sb1_stop;
+
+static
+void
+sb1waiter(void *junk, unsigned long num)
+{
+	unsigned gen;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(sb1_lock);
+	gen = sb1_gen;
+	while (!sb1_stop) {
+		if (++sb1_nwaiting == sb1_nwaiters) {
+			cv_signal(sb1_readycv, sb1_lock);
+		}
+		while (sb1_gen == gen) {
+			cv_wait(sb1_cv, sb1_lock);
+		}
+		gen = sb1_gen;
+	}
+	lock_release(sb1_lock);
+	V(sb_done);
+}
+
+int
+cvbroadcastbench(int nargs, char **args)
+{
+	unsigned i, rounds;
+	uint64_t start, total, before, incall;
+
+	if (nargs > 3) {
+		kprintf("Usage: sb1 [waiters [rounds]]\n");
+		return EINVAL;
+	}
+	sb1_nwaiters = SB1_WAITERS;
+	rounds = SB1_ROUNDS;
+	if (nargs > 1) {
+		sb1_nwaiters = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		rounds = atoi(args[2]);
+	}
+	if (sb1_nwaiters == 0 || rounds == 0) {
+		kprintf("sb1: need at least one waiter and one round\n");
+		return EINVAL;
+	}
+
+	sb_init();
+	sb1_lock = lock_create("sb1_lock");
+	sb1_cv = cv_create("sb1_cv");
+	sb1_readycv = cv_create("sb1_readycv");
+	if (sb1_lock == NULL || sb1_cv == NULL || sb1_readycv == NULL) {
+		panic("sb1: out of memory\n");
+	}
+	sb1_gen = 0;
+	sb1_nwaiting = 0;
+	sb1_stop = false;
+
+	kprintf("Starting cv_broadcast benchmark: %u waiters, %u rounds...\n",
+		sb1_nwaiters, rounds);
+
+	for (i=0; i<sb1_nwaiters; i++) {
+		sb_fork("sb1_waiter", sb1waiter, i);
+	}
+
+	incall = 0;
+	total = 0;
+	start = 0;
+	lock_acquire(sb1_lock);
+	for (i=0; i<=rounds; i++) {
+		while (sb1_nwaiting < sb1_nwaiters) {
+			cv_wait(sb1_readycv, sb1_lock);
+		}
+		if (i == 0) {
+			/* Everyone's started; the clock starts now. */
+			start = clock_nsecs();
+		}
+		sb1_nwaiting = 0;
+		sb1_gen++;
+		if (i == rounds) {
+			/* Last broadcast just sends them home. */
+			total = clock_nsecs() - start;
+			sb1_stop = true;
+			cv_broadcast(sb1_cv, sb1_lock);
+			break;
+		}
+		before = clock_nsecs();
+		cv_broadcast(sb1_cv, sb1_lock);
+		incall += clock_nsecs() - before;
+	}
+	lock_release(sb1_lock);
+
+	for (i=0; i<sb1_nwaiters; i++) {
+		P(sb_done);
+	}
+
+	kprintf("sb1: %u waiters: %u ns per round, %u ns in cv_broadcast\n",
+		sb1_nwaiters, (unsigned)(total / rounds),
+		(unsigned)(incall / rounds));
+
+	cv_destroy(sb1_readycv);
+	cv_destroy(sb1_cv);
+	lock_destroy(sb1_lock);
+	kprintf("cv_broadcast benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb2: lock throughput
+
+/*
+ * Each worker takes the same lock over and over around a short
+ * critical section. Each cpu count runs twice, once with lock_acquire
+ * sleeping as soon as the lock is busy and once with it spinning
+ * while the holder runs; reports lock operations per millisecond.
+ */
+
+#define SB2_ITERS  20000
+
+static struct lock *sb2_lock;
+static volatile unsigned long sb2_counter;
+static unsigned sb2_iters;
+
+static
+void
+sb2worker(void *junk, unsigned long num)
+{
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<sb2_iters; i++) {
+		lock_acquire(sb2_lock);
+		for (j=0; j<10; j++) {
+			sb2_counter++;
+		}
+		lock_release(sb2_lock);
+	}
+	V(sb_done);
+}
+
+/*
+ * Run NCPUS workers with the given spin limit; return the rate.
+ */
+static
+unsigned
+sb2run(unsigned ncpus, unsigned spinlimit)
+{
+	unsigned i;
+	uint64_t start;
+
+	lock_spinlimit = spinlimit;
+	sb2_counter = 0;
+	start = clock_nsecs();
+	for (i=0; i<ncpus; i++) {
+		sb_forkon("sb2_worker", sb2worker, i, i);
+	}
+	for (i=0; i<ncpus; i++) {
+		P(sb_done);
+	}
+	KASSERT(sb2_counter == (unsigned long)ncpus * sb2_iters * 10);
+	return sb_rate((uint64_t)ncpus * sb2_iters, clock_nsecs() - start);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned ncpus, maxcpus, savedlimit;
+	unsigned sleeprate, spinrate;
+
+	if (nargs > 2) {
+		kprintf("Usage: sb2 [iterations]\n");
+		return EINVAL;
+	}
+	sb2_iters = SB2_ITERS;
+	if (nargs == 2) {
+		sb2_iters = atoi(args[1]);
+	}
+
+	sb_init();
+	sb2_lock = lock_create("sb2_lock");
+	if (sb2_lock == NULL) {
+		panic("sb2: lock_create failed\n");
+	}
+	savedlimit = lock_spinlimit;
+	maxcpus = cpu_count();
+
+	kprintf("Starting lock throughput benchmark...\n");
+	kprintf("%5s %12s %12s\n", "cpus", "sleep ops/ms", "spin ops/ms");
+	for (ncpus = 1; ncpus <= 8 && ncpus <= maxcpus; ncpus *= 2) {
+		sleeprate = sb2run(ncpus, 0);
+		spinrate = sb2run(ncpus, savedlimit ? savedlimit : LOCK_SPINLIMIT);
+		kprintf("%5u %12u %12u\n", ncpus, sleeprate, spinrate);
+	}
+
+	lock_spinlimit = savedlimit;
+	lock_destroy(sb2_lock);
+	kprintf("Lock throughput benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb3: reader scaling
+
+/*
+ * Each worker repeatedly looks through a small shared table, first
+ * under a lock and then under an rwlock held for reading; reports
+ * lookups per millisecond. With the lock, adding cpus adds
+ * contention; with the rwlock the readers don't wait for each other,
+ * so the rate should grow with the number of cpus.
+ */
+
+#define SB3_ITERS    20000
+#define SB3_TABLE    16
+
+static struct lock *sb3_lock;
+static struct rwlock *sb3_rwlock;
+static bool sb3_userw;
+static unsigned sb3_iters;
+static unsigned sb3_table[SB3_TABLE];
+
+static
+void
+sb3reader(void *junk, unsigned long num)
+{
+	unsigned i, j, sum;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<sb3_iters; i++) {
+		if (sb3_userw) {
+			rwlock_acquire_read(sb3_rwlock);
+		}
+		else {
+			lock_acquire(sb3_lock);
+		}
+		sum = 0;
+		for (j=0; j<SB3_TABLE; j++) {
+			sum += sb3_table[j];
+		}
+		KASSERT(sum == SB3_TABLE * (SB3_TABLE - 1) / 2);
+		if (sb3_userw) {
+			rwlock_release_read(sb3_rwlock);
+		}
+		else {
+			lock_release(sb3_lock);
+		}
+	}
+	V(sb_done);
+}
+
+/*
+ * Run NCPUS readers; return the rate.
+ */
+static
+unsigned
+sb3run(unsigned ncpus, bool userw)
+{
+	unsigned i;
+	uint64_t start;
+
+	sb3_userw = userw;
+	start = clock_nsecs();
+	for (i=0; i<ncpus; i++) {
+		sb_forkon("sb3_reader", sb3reader, i, i);
+	}
+	for (i=0; i<ncpus; i++) {
+		P(sb_done);
+	}
+	return sb_rate((uint64_t)ncpus * sb3_iters, clock_nsecs() - start);
+}
+
+int
+rwlockbench(int nargs, char **args)
+{
+	unsigned i, ncpus, maxcpus;
+	unsigned lockrate, rwrate;
+
+	if (nargs > 2) {
+		kprintf("Usage: sb3 [iterations]\n");
+		return EINVAL;
+	}
+	sb3_iters = SB3_ITERS;
+	if (nargs == 2) {
+		sb3_iters = atoi(args[1]);
+	}
+
+	sb_init();
+	sb3_lock = lock_create("sb3_lock");
+	sb3_rwlock = rwlock_create("sb3_rwlock");
+	if (sb3_lock == NULL || sb3_rwlock == NULL) {
+		panic("sb3: out of memory\n");
+	}
+	for (i=0; i<SB3_TABLE; i++) {
+		sb3_table[i] = i;
+	}
+	maxcpus = cpu_count();
+
+	kprintf("Starting reader scaling benchmark...\n");
+	kprintf("%5s %15s %15s\n", "cpus", "lock reads/ms", "rwlock reads/ms");
+	for (ncpus = 1; ncpus <= 8 && ncpus <= maxcpus; ncpus *= 2) {
+		lockrate = sb3run(ncpus, false);
+		rwrate = sb3run(ncpus, true);
+		kprintf("%5u %15u %15u\n", ncpus, lockrate, rwrate);
+	}
+
+	rwlock_destroy(sb3_rwlock);
+	lock_destroy(sb3_lock);
+	kprintf("Reader scaling benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb4: spinlock contention
+
+/*
+ * Each worker takes the same spinlock over and over for a second.
+ * Reports the total acquisitions per millisecond and the smallest
+ * and largest share any one cpu got, which shows how fair the lock
+ * is. Build with and without the ticketlock option to compare.
+ */
+
+#define SB4_SECS  1
+#define SB4_MAXCPUS  8
+
+static struct spinlock sb4_lock = SPINLOCK_INITIALIZER;
+static volatile bool sb4_stop;
+static volatile unsigned long sb4_counter;
+static unsigned long sb4_count[SB4_MAXCPUS];
+
+static
+void
+sb4worker(void *junk, unsigned long num)
+{
+	unsigned long count = 0;
+
+	(void)junk;
+
+	while (!sb4_stop) {
+		spinlock_acquire(&sb4_lock);
+		sb4_counter++;
+		spinlock_release(&sb4_lock);
+		count++;
+	}
+	sb4_count[num] = count;
+	V(sb_done);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	unsigned i, ncpus, maxcpus;
+	unsigned long total, min, max;
+
+	(void)args;
+
+	if (nargs > 1) {
+		kprintf("Usage: sb4\n");
+		return EINVAL;
+	}
+
+	sb_init();
+	maxcpus = cpu_count();
+
+	kprintf("Starting spinlock contention benchmark (%s)...\n",
+		OPT_TICKETLOCK ? "ticket locks" : "test-and-set locks");
+	kprintf("%5s %10s %8s %8s\n", "cpus", "acq/ms", "min %", "max %");
+	for (ncpus = 1; ncpus <= SB4_MAXCPUS && ncpus <= maxcpus; ncpus *= 2) {
+		sb4_stop = false;
+		sb4_counter = 0;
+		for (i=0; i<ncpus; i++) {
+			sb_forkon("sb4_worker", sb4worker, i, i);
+		}
+		clocksleep(SB4_SECS);
+		sb4_stop = true;
+		for (i=0; i<ncpus; i++) {
+			P(sb_done);
+		}
+
+		total = 0;
+		min = max = sb4_count[0];
+		for (i=0; i<ncpus; i++) {
+			total += sb4_count[i];
+			if (sb4_count[i] < min) {
+				min = sb4_count[i];
+			}
+			if (sb4_count[i] > max) {
+				max = sb4_count[i];
+			}
+		}
+		KASSERT(total == sb4_counter);
+		if (total == 0) {
+			total = 1;
+		}
+		kprintf("%5u %10lu %8lu %8lu\n", ncpus,
+			total / (SB4_SECS * 1000),
+			min * 100 / total, max * 100 / total);
+	}
+
+	kprintf("Spinlock contention benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb5: lock fairness and handoff
+
+/*
+ * A bunch of threads, spread over the cpus, hammer one lock with a
+ * tiny critical section for a second, first with the lock in its
+ * usual barging mode and then in handoff mode (see lock_sethandoff).
+ * Reports acquisitions per millisecond, the smallest and largest
+ * share any one thread got, and the median, 99th percentile, and
+ * worst time a thread spent in lock_acquire. Percentiles come from a
+ * power-of-two histogram, so they're upper bounds.
+ */
+
+#define SB5_SECS     1
+#define SB5_THREADS  8
+#define SB5_BUCKETS  24		/* up to 2^23 us, about 8 seconds */
+
+static struct lock *sb5_lock;
+static volatile bool sb5_stop;
+static volatile unsigned long sb5_counter;
+static unsigned long sb5_count[SB5_THREADS];
+static uint64_t sb5_max[SB5_THREADS];
+static unsigned long sb5_hist[SB5_THREADS][SB5_BUCKETS];
+
+/* Histogram bucket for a wait of NSECS: b means less than 2^b us. */
+static
+unsigned
+sb5bucket(uint64_t nsecs)
+{
+	uint64_t usecs = nsecs / 1000;
+	unsigned b = 0;
+
+	while (usecs > 0 && b < SB5_BUCKETS - 1) {
+		usecs >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static
+void
+sb5worker(void *junk, unsigned long num)
+{
+	uint64_t start, wait;
+	unsigned long count = 0;
+	unsigned j;
+
+	(void)junk;
+
+	while (!sb5_stop) {
+		start = clock_nsecs();
+		lock_acquire(sb5_lock);
+		wait = clock_nsecs() - start;
+		for (j=0; j<10; j++) {
+			sb5_counter++;
+		}
+		lock_release(sb5_lock);
+
+		count++;
+		sb5_hist[num][sb5bucket(wait)]++;
+		if (wait > sb5_max[num]) {
+			sb5_max[num] = wait;
+		}
+	}
+	sb5_count[num] = count;
+	V(sb_done);
+}
+
+/*
+ * Bucket holding the PCT'th percentile of TOTAL samples in HIST;
+ * returns its upper bound in microseconds.
+ */
+static
+unsigned
+sb5percentile(const unsigned long *hist, unsigned long total, unsigned pct)
+{
+	unsigned long want, seen = 0;
+	unsigned b;
+
+	want = (total * pct + 99) / 100;
+	for (b=0; b<SB5_BUCKETS - 1; b++) {
+		seen += hist[b];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return 1U << b;
+}
+
+static
+void
+sb5run(unsigned ncpus, bool handoff)
+{
+	unsigned i, b;
+	unsigned long total, min, max;
+	unsigned long hist[SB5_BUCKETS];
+	uint64_t maxwait;
+
+	lock_sethandoff(sb5_lock, handoff);
+	sb5_stop = false;
+	sb5_counter = 0;
+	bzero(sb5_hist, sizeof(sb5_hist));
+	bzero(sb5_max, sizeof(sb5_max));
+	for (i=0; i<SB5_THREADS; i++) {
+		sb_forkon("sb5_worker", sb5worker, i, i % ncpus);
+	}
+	clocksleep(SB5_SECS);
+	sb5_stop = true;
+	for (i=0; i<SB5_THREADS; i++) {
+		P(sb_done);
+	}
+
+	total = 0;
+	min = max = sb5_count[0];
+	maxwait = 0;
+	bzero(hist, sizeof(hist));
+	for (i=0; i<SB5_THREADS; i++) {
+		total += sb5_count[i];
+		if (sb5_count[i] < min) {
+			min = sb5_count[i];
+		}
+		if (sb5_count[i] > max) {
+			max = sb5_count[i];
+		}
+		if (sb5_max[i] > maxwait) {
+			maxwait = sb5_max[i];
+		}
+		for (b=0; b<SB5_BUCKETS; b++) {
+			hist[b] += sb5_hist[i][b];
+		}
+	}
+	KASSERT(sb5_counter == total * 10);
+	if (total == 0) {
+		total = 1;
+	}
+	kprintf("%-8s %8lu %6lu %6lu %8u %8u %10llu\n",
+		handoff ? "handoff" : "barging",
+		total / (SB5_SECS * 1000),
+		min * 100 / total, max * 100 / total,
+		sb5percentile(hist, total, 50),
+		sb5percentile(hist, total, 99),
+		(unsigned long long)(maxwait / 1000));
+}
+
+int
+lockhandoffbench(int nargs, char **args)
+{
+	unsigned ncpus;
+
+	(void)args;
+
+	if (nargs > 1) {
+		kprintf("Usage: sb5\n");
+		return EINVAL;
+	}
+
+	sb_init();
+	sb5_lock = lock_create("sb5_lock");
+	if (sb5_lock == NULL) {
+		panic("sb5: lock_create failed\n");
+	}
+	ncpus = cpu_count();
+
+	kprintf("Starting lock handoff benchmark (%u threads, %u cpus)...\n",
+		SB5_THREADS, ncpus);
+	kprintf("%-8s %8s %6s %6s %8s %8s %10s\n", "mode", "acq/ms",
+		"min %", "max %", "p50 us", "p99 us", "max us");
+	sb5run(ncpus, false);
+	sb5run(ncpus, true);
+
+	lock_destroy(sb5_lock);
+	kprintf("Lock handoff benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb6: cv wait morphing
+
+/*
+ * Modeled on widefork run several times at once: each of a handful
+ * of parents forks a few children and waits for them in order, and
+ * each child "exits" by setting a flag and doing cv_broadcast on one
+ * cv shared by everybody, the way sys__exit and sys_waitpid use
+ * procinfolist_cv. Run with cv_waitmorph off and on, and report the
+ * context switches and time taken.
+ */
+
+#define SB6_PARENTS   4
+#define SB6_CHILDREN  3
+#define SB6_ROUNDS    100
+
+static struct lock *sb6_lock;
+static struct cv *sb6_cv;
+static bool sb6_exited[SB6_PARENTS * SB6_CHILDREN];
+
+static
+void
+sb6child(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	lock_acquire(sb6_lock);
+	sb6_exited[num] = true;
+	cv_broadcast(sb6_cv, sb6_lock);
+	lock_release(sb6_lock);
+}
+
+static
+void
+sb6parent(void *junk, unsigned long num)
+{
+	unsigned i, j, child;
+
+	(void)junk;
+
+	for (i=0; i<SB6_ROUNDS; i++) {
+		for (j=0; j<SB6_CHILDREN; j++) {
+			child = num * SB6_CHILDREN + j;
+			sb6_exited[child] = false;
+			sb_fork("sb6_child", sb6child, child);
+		}
+		for (j=0; j<SB6_CHILDREN; j++) {
+			child = num * SB6_CHILDREN + j;
+			lock_acquire(sb6_lock);
+			while (!sb6_exited[child]) {
+				cv_wait(sb6_cv, sb6_lock);
+			}
+			lock_release(sb6_lock);
+		}
+	}
+	V(sb_done);
+}
+
+static
+void
+sb6run(bool morph)
+{
+	unsigned i, switches;
+	uint64_t start, nsecs;
+
+	cv_waitmorph = morph;
+	switches = cpu_switchcount();
+	start = clock_nsecs();
+	for (i=0; i<SB6_PARENTS; i++) {
+		sb_fork("sb6_parent", sb6parent, i);
+	}
+	for (i=0; i<SB6_PARENTS; i++) {
+		P(sb_done);
+	}
+	nsecs = clock_nsecs() - start;
+	switches = cpu_switchcount() - switches;
+	kprintf("%-10s %10u %14u %10u\n", morph ? "morphing" : "waking",
+		switches, switches / (SB6_PARENTS * SB6_ROUNDS * SB6_CHILDREN),
+		(unsigned)(nsecs / 1000000));
+}
+
+int
+cvmorphbench(int nargs, char **args)
+{
+	bool savedmorph;
+
+	(void)args;
+
+	if (nargs > 1) {
+		kprintf("Usage: sb6\n");
+		return EINVAL;
+	}
+
+	sb_init();
+	sb6_lock = lock_create("sb6_lock");
+	sb6_cv = cv_create("sb6_cv");
+	if (sb6_lock == NULL || sb6_cv == NULL) {
+		panic("sb6: out of memory\n");
+	}
+	savedmorph = cv_waitmorph;
+
+	kprintf("Starting cv wait morphing benchmark "
+		"(%u parents, %u children each, %u rounds)...\n",
+		SB6_PARENTS, SB6_CHILDREN, SB6_ROUNDS);
+	kprintf("%-10s %10s %14s %10s\n", "cv", "switches", "per child",
+		"ms");
+	sb6run(false);
+	sb6run(true);
+
+	cv_waitmorph = savedmorph;
+	cv_destroy(sb6_cv);
+	lock_destroy(sb6_lock);
+	kprintf("cv wait morphing benchmark done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// sb7: pid lookup with rcu
+
+/*
+ * Each worker looks up a pid with procinfo_lookup as fast as it can
+ * for a second, first under procinfolist_rwlock and then in the
+ * table published for rcu readers. Reports lookups per millisecond for each, then the time
+ * rcu_synchronize takes to wait out a grace period, which is what a
+ * writer would pay to free the old version itself.
+ *
+ * The kernel process has no procinfo, so the benchmark adds its own
+ * entry, with a pid no real process gets, for the duration.
+ */
+
+#define SB7_SECS     1
+#define SB7_MAXCPUS  8
+#define SB7_SYNCS    10
+#define SB7_PID      PID_MAX
+
+#if OPT_A2
+static volatile bool sb7_stop;
+static unsigned long sb7_count[SB7_MAXCPUS];
+
+/*
+ * Add (if PI isn't NULL) or remove (if it is) the benchmark's entry
+ * in procinfolist.
+ */
+static
+int
+sb7entry(struct procinfo *pi)
+{
+	int result;
+
+	rwlock_acquire_write(procinfolist_rwlock);
+	if (pi != NULL) {
+		KASSERT(procinfoarray_get_by_pid(procinfolist, SB7_PID) == NULL);
+		result = procinfoarray_add(procinfolist, pi, NULL);
+		if (result) {
+			rwlock_release_write(procinfolist_rwlock);
+			return result;
+		}
+	}
+	else {
+		pi = procinfoarray_get_by_pid(procinfolist, SB7_PID);
+		KASSERT(pi != NULL);
+		procinfoarray_remove_by_pid(procinfolist, SB7_PID);
+		procinfo_retire(pi);
+	}
+	procinfo_publish();
+	rwlock_release_write(procinfolist_rwlock);
+	return 0;
+}
+
+static
+void
+sb7worker(void *junk, unsigned long num)
+{
+	unsigned long count = 0;
+
+	(void)junk;
+
+	while (!sb7_stop) {
+		if (procinfo_lookup(SB7_PID) == NULL) {
+			panic("sb7: benchmark pid not found\n");
+		}
+		count++;
+	}
+	sb7_count[num] = count;
+	V(sb_done);
+}
+
+static
+unsigned long
+sb7run(unsigned ncpus, bool rcu)
+{
+	unsigned i;
+	unsigned long total;
+
+	procinfo_rcu = rcu;
+	sb7_stop = false;
+	for (i=0; i<ncpus; i++) {
+		sb_forkon("sb7_worker", sb7worker, i, i);
+	}
+	clocksleep(SB7_SECS);
+	sb7_stop = true;
+	for (i=0; i<ncpus; i++) {
+		P(sb_done);
+	}
+
+	total = 0;
+	for (i=0; i<ncpus; i++) {
+		total += sb7_count[i];
+	}
+	return total / (SB7_SECS * 1000);
+}
+#endif /* OPT_A2 */
+
+int
+pidlookupbench(int nargs, char **args)
+{
+	unsigned i;
+	uint64_t start, nsecs;
+#if OPT_A2
+	unsigned ncpus, maxcpus;
+	unsigned long locked, lockfree;
+	struct procinfo *pi;
+	bool savedrcu;
+#endif
+
+	(void)args;
+
+	if (nargs > 1) {
+		kprintf("Usage: sb7\n");
+		return EINVAL;
+	}
+
+	sb_init();
+
+#if OPT_A2
+	if (procinfolist == NULL || procinfolist_rwlock == NULL) {
+		/* These are set up by the first proc_create_runprogram. */
+		kprintf("sb7: no process table yet; run a program first\n");
+		return 0;
+	}
+
+	pi = kmalloc(sizeof(*pi));
+	if (pi == NULL) {
+		return ENOMEM;
+	}
+	pi->pid = SB7_PID;
+	pi->ppid = -1;
+	pi->exit_status = 0;
+	pi->state = RUNNING;
+	if (sb7entry(pi)) {
+		kfree(pi);
+		return ENOMEM;
+	}
+
+	maxcpus = cpu_count();
+	savedrcu = procinfo_rcu;
+
+	kprintf("Starting pid lookup benchmark...\n");
+	kprintf("%5s %12s %12s\n", "cpus", "rwlock/ms", "rcu/ms");
+	for (ncpus = 1; ncpus <= SB7_MAXCPUS && ncpus <= maxcpus; ncpus *= 2) {
+		locked = sb7run(ncpus, false);
+		lockfree = sb7run(ncpus, true);
+		kprintf("%5u %12lu %12lu\n", ncpus, locked, lockfree);
+	}
+	procinfo_rcu = savedrcu;
+
+	/* freed by rcu once the lookups are done with it */
+	sb7entry(NULL);
+#else
+	kprintf("sb7: no procinfo lookups without the A2 process code\n");
+#endif
+
+	start = clock_nsecs();
+	for (i=0; i<SB7_SYNCS; i++) {
+		rcu_synchronize();
+	}
+	nsecs = clock_nsecs() - start;
+	kprintf("rcu grace period: %u us average over %u\n",
+		(unsigned)(nsecs / SB7_SYNCS / 1000), SB7_SYNCS);
+
+	kprintf("Pid lookup benchmark done\n");
+	return 0;
+}
@@ -46,16 +46,26 @@
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
 static volatile unsigned long testval3;
+
+/*
+ * semtest hands testsem to its threads one at a time and waits on
+ * donesem for each. startgate and donebarrier are the start and done
+ * (see synch.h) for the lock and cv tests.
+ */
 #ifdef UW
 static struct semaphore *testsem = 0;
 static struct lock *testlock = 0;
 static struct cv *testcv = 0;
 static struct semaphore *donesem = 0;
+static struct completion *startgate = 0;
+static struct barrier *donebarrier = 0;
 #else
 static struct semaphore *testsem;
 static struct lock *testlock;
 static struct cv *testcv;
 static struct semaphore *donesem;
+static struct completion *startgate;
+static struct barrier *donebarrier;
 #endif
 
 #ifdef UW
@@ -68,6 +78,14 @@ cleanitems(void)
 	lock_destroy(testlock);
 	cv_destroy(testcv);
 	sem_destroy(donesem);
+	completion_destroy(startgate);
+	barrier_destroy(donebarrier);
+	testsem = NULL;
+	testlock = NULL;
+	testcv = NULL;
+	donesem = NULL;
+	startgate = NULL;
+	donebarrier = NULL;
 	}
 #endif
 
@@ -103,6 +121,40 @@ inititems(void)
 			panic("synchtest: sem_create failed\n");
 		}
 	}
+	if (startgate==NULL) {
+		startgate = completion_create("startgate");
+		if (startgate == NULL) {
+			panic("synchtest: completion_create failed\n");
+		}
+	}
+	if (donebarrier==NULL) {
+		donebarrier = barrier_create("donebarrier", NTHREADS + 1);
+		if (donebarrier == NULL) {
+			panic("synchtest: barrier_create failed\n");
+		}
+	}
+}
+
+/*
+ * Fork NTHREADS copies of FUNC, let them all go at once, and wait
+ * for them to finish.
+ */
+static
+void
+runthreads(const char *name, void (*func)(void *, unsigned long))
+{
+	int i, result;
+
+	completion_reinit(startgate);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, func, NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+	complete_all(startgate);
+	barrier_wait(donebarrier);
 }
 
 static
@@ -175,7 +227,7 @@ fail(unsigned long num, const char *msg)
 
 	lock_release(testlock);
 
-	V(donesem);
+	barrier_wait(donebarrier);
 	thread_exit();
 }
 
@@ -186,6 +238,7 @@ locktestthread(void *junk, unsigned long num)
 	int i;
 	(void)junk;
 
+	completion_wait(startgate);
 	for (i=0; i<NLOCKLOOPS; i++) {
 		lock_acquire(testlock);
 		testval1 = num;
@@ -218,7 +271,7 @@ locktestthread(void *junk, unsigned long num)
 
 		lock_release(testlock);
 	}
-	V(donesem);
+	barrier_wait(donebarrier);
 #ifdef UW
   thread_exit();
 #endif
@@ -228,25 +281,13 @@ locktestthread(void *junk, unsigned long num)
 int
 locktest(int nargs, char **args)
 {
-	int i, result;
-
 	(void)nargs;
 	(void)args;
 
 	inititems();
 	kprintf("Starting lock test...\n");
 
-	for (i=0; i<NTHREADS; i++) {
-		result = thread_fork("synchtest", NULL, locktestthread,
-				     NULL, i);
-		if (result) {
-			panic("locktest: thread_fork failed: %s\n",
-			      strerror(result));
-		}
-	}
-	for (i=0; i<NTHREADS; i++) {
-		P(donesem);
-	}
+	runthreads("locktest", locktestthread);
 
 #ifdef UW
   cleanitems();
@@ -267,6 +308,7 @@ cvtestthread(void *junk, unsigned long num)
 
 	(void)junk;
 
+	completion_wait(startgate);
 	for (i=0; i<NCVLOOPS; i++) {
 		lock_acquire(testlock);
 		while (testval1 != num) {
@@ -287,7 +329,7 @@ cvtestthread(void *junk, unsigned long num)
 				kprintf("cv_wait took only %u ns\n", nsecs2);
 				kprintf("That's too fast... you must be "
 					"busy-looping\n");
-				V(donesem);
+				barrier_wait(donebarrier);
 				thread_exit();
 			}
 
@@ -304,7 +346,7 @@ cvtestthread(void *junk, unsigned long num)
 		cv_broadcast(testcv, testlock);
 		lock_release(testlock);
 	}
-	V(donesem);
+	barrier_wait(donebarrier);
 #ifdef UW
   thread_exit();
 #endif
@@ -314,8 +356,6 @@ int
 cvtest(int nargs, char **args)
 {
 
-	int i, result;
-
 	(void)nargs;
 	(void)args;
 
@@ -329,16 +369,7 @@ cvtest(int nargs, char **args)
 
 	testval1 = NTHREADS-1;
 
-	for (i=0; i<NTHREADS; i++) {
-		result = thread_fork("synchtest", NULL, cvtestthread, NULL, i);
-		if (result) {
-			panic("cvtest: thread_fork failed: %s\n",
-			      strerror(result));
-		}
-	}
-	for (i=0; i<NTHREADS; i++) {
-		P(donesem);
-	}
+	runthreads("cvtest", cvtestthread);
 
 #ifdef UW
   cleanitems();
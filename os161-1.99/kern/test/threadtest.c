@@ -31,23 +31,35 @@
  * Thread test code.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
 
 #define NTHREADS  8
 
-static struct semaphore *tsem = NULL;
+#define TT4_PAIRS  4000		/* see threadtest4 */
+#define TT4_BATCH  4
+
+/* Start and done for the threads of a run (see synch.h). */
+static struct completion *tstart = NULL;
+static struct barrier *tdone = NULL;
+
+/* The same for each batch of tt4 threads, without the start. */
+static struct barrier *tt4done = NULL;
 
 static
 void
-init_sem(void)
+init_sync(void)
 {
-	if (tsem==NULL) {
-		tsem = sem_create("tsem", 0);
-		if (tsem == NULL) {
-			panic("threadtest: sem_create failed\n");
+	if (tstart==NULL) {
+		tstart = completion_create("tstart");
+		tdone = barrier_create("tdone", NTHREADS + 1);
+		tt4done = barrier_create("tt4done", TT4_BATCH + 1);
+		if (tstart == NULL || tdone == NULL || tt4done == NULL) {
+			panic("threadtest: out of memory\n");
 		}
 	}
 }
@@ -61,10 +73,11 @@ loudthread(void *junk, unsigned long num)
 
 	(void)junk;
 
+	completion_wait(tstart);
 	for (i=0; i<120; i++) {
 		putch(ch);
 	}
-	V(tsem);
+	barrier_wait(tdone);
 }
 
 /*
@@ -86,11 +99,12 @@ quietthread(void *junk, unsigned long num)
 
 	(void)junk;
 
+	completion_wait(tstart);
 	putch(ch);
 	for (i=0; i<200000; i++);
 	putch(ch);
 
-	V(tsem);
+	barrier_wait(tdone);
 }
 
 static
@@ -100,6 +114,7 @@ runthreads(int doloud)
 	char name[16];
 	int i, result;
 
+	completion_reinit(tstart);
 	for (i=0; i<NTHREADS; i++) {
 		snprintf(name, sizeof(name), "threadtest%d", i);
 		result = thread_fork(name, NULL,
@@ -111,9 +126,8 @@ runthreads(int doloud)
 		}
 	}
 
-	for (i=0; i<NTHREADS; i++) {
-		P(tsem);
-	}
+	complete_all(tstart);
+	barrier_wait(tdone);
 }
 
 
@@ -123,7 +137,7 @@ threadtest(int nargs, char **args)
 	(void)nargs;
 	(void)args;
 
-	init_sem();
+	init_sync();
 	kprintf("Starting thread test...\n");
 	runthreads(1);
 	kprintf("\nThread test done.\n");
@@ -137,10 +151,80 @@ threadtest2(int nargs, char **args)
 	(void)nargs;
 	(void)args;
 
-	init_sem();
+	init_sync();
 	kprintf("Starting thread test 2...\n");
 	runthreads(0);
 	kprintf("\nThread test 2 done.\n");
 
 	return 0;
 }
+
+/*
+ * Thread test 4: fork/exit throughput. Fork threads that exit right
+ * away, TT4_BATCH at a time, and report create/exit pairs per
+ * second. Repeated forks should mostly be served from the per-cpu
+ * pool of reaped threads (see "poolhits" in the cpu menu command).
+ */
+
+static
+void
+tt4thread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	barrier_wait(tt4done);
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	unsigned long pairs, msecs;
+	int i, j, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: tt4 [pairs]\n");
+		return EINVAL;
+	}
+	pairs = TT4_PAIRS;
+	if (nargs == 2) {
+		pairs = atoi(args[1]);
+		if (pairs < TT4_BATCH) {
+			pairs = TT4_BATCH;
+		}
+	}
+	pairs -= pairs % TT4_BATCH;
+
+	init_sync();
+	kprintf("Starting thread test 4...\n");
+
+	gettime(&beforesecs, &beforensecs);
+
+	for (i=0; i < (int)pairs; i += TT4_BATCH) {
+		for (j=0; j<TT4_BATCH; j++) {
+			result = thread_fork("tt4", NULL, tt4thread, NULL, j);
+			if (result) {
+				panic("tt4: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		barrier_wait(tt4done);
+	}
+
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+
+	msecs = secs * 1000 + nsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	kprintf("tt4: %lu create/exit pairs in %lu.%09lu sec "
+		"(%lu pairs/sec)\n", pairs, (unsigned long)secs,
+		(unsigned long)nsecs, pairs * 1000 / msecs);
+	kprintf("Thread test 4 done.\n");
+
+	return 0;
+}
@@ -60,7 +60,15 @@ static struct wchan *waitchans[NWAITCHANS];  /* N distinct wait channels */
 
 static volatile int wakerdone;
 static struct semaphore *wakersem;
-static struct semaphore *donesem;
+
+/*
+ * Start and done for the sleepalots and computes (see synch.h). The
+ * waker isn't counted at donebarrier; it's told to stop afterwards
+ * and signals wakerexit on its way out.
+ */
+static struct completion *startgate;
+static struct barrier *donebarrier;
+static struct completion *wakerexit;
 
 static
 void
@@ -71,13 +79,16 @@ setup(void)
 
 	if (wakersem == NULL) {
 		wakersem = sem_create("wakersem", 1);
-		donesem = sem_create("donesem", 0);
+		startgate = completion_create("startgate");
+		wakerexit = completion_create("wakerexit");
 		for (i=0; i<NWAITCHANS; i++) {
 			snprintf(tmp, sizeof(tmp), "wc%d", i);
 			waitchans[i] = wchan_create(kstrdup(tmp));
 		}
 	}
 	wakerdone = 0;
+	completion_reinit(startgate);
+	completion_reinit(wakerexit);
 }
 
 static
@@ -88,6 +99,7 @@ sleepalot_thread(void *junk, unsigned long num)
 
 	(void)junk;
 
+	completion_wait(startgate);
 	for (i=0; i<SLEEPALOT_PRINTS; i++) {
 		for (j=0; j<SLEEPALOT_ITERS; j++) {
 			struct wchan *w;
@@ -98,7 +110,7 @@ sleepalot_thread(void *junk, unsigned long num)
 		}
 		kprintf("[%lu]", num);
 	}
-	V(donesem);
+	barrier_wait(donebarrier);
 }
 
 static
@@ -110,6 +122,7 @@ waker_thread(void *junk1, unsigned long junk2)
 	(void)junk1;
 	(void)junk2;
 
+	completion_wait(startgate);
 	while (1) {
 		P(wakersem);
 		done = wakerdone;
@@ -127,7 +140,7 @@ waker_thread(void *junk1, unsigned long junk2)
 			thread_yield();
 		}
 	}
-	V(donesem);
+	complete(wakerexit);
 }
 
 static
@@ -164,6 +177,7 @@ compute_thread(void *junk1, unsigned long num)
 
 	(void)junk1;
 
+	completion_wait(startgate);
 	m1 = kmalloc(sizeof(struct matrix));
 	KASSERT(m1 != NULL);
 	m2 = kmalloc(sizeof(struct matrix));
@@ -204,7 +218,7 @@ compute_thread(void *junk1, unsigned long num)
 	kfree(m2);
 	kfree(m3);
 
-	V(donesem);
+	barrier_wait(donebarrier);
 }
 
 static
@@ -225,16 +239,13 @@ make_computes(int howmany)
 
 static
 void
-finish(int howmanytotal)
+finish(void)
 {
-	int i;
-	for (i=0; i<howmanytotal; i++) {
-		P(donesem);
-	}
+	barrier_wait(donebarrier);
 	P(wakersem);
 	wakerdone = 1;
 	V(wakersem);
-	P(donesem);
+	completion_wait(wakerexit);
 }
 
 static
@@ -242,12 +253,18 @@ void
 runtest3(int nsleeps, int ncomputes)
 {
 	setup();
+	donebarrier = barrier_create("donebarrier", nsleeps + ncomputes + 1);
+	if (donebarrier == NULL) {
+		panic("tt3: barrier_create failed\n");
+	}
 	kprintf("Starting thread test 3 (%d [sleepalots], %d {computes}, "
 		"1 waker)\n",
 		nsleeps, ncomputes);
 	make_sleepalots(nsleeps);
 	make_computes(ncomputes);
-	finish(nsleeps+ncomputes);
+	complete_all(startgate);
+	finish();
+	barrier_destroy(donebarrier);
 	kprintf("\nThread test 3 done\n");
 }
 
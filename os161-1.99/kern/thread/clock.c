@@ -27,21 +27,36 @@
  * SUCH DAMAGE.
  */
 
+
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
+#include <syscall.h>
+#include <mainbus.h>
+#include <platform/maxcpus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Timed operations are built on timers: a timer calls a function
+ * from the timer interrupt once its deadline has passed. Timers are
+ * kept in per-cpu timer wheels, which timerclock() advances, and the
+ * timer device is programmed as a one-shot for whichever comes first,
+ * the next tick or the earliest deadline known to be within the
+ * current tick. So timers can expire between ticks, and only the
+ * threads whose deadlines have passed ever wake up.
+ *
+ * Idle cpus go "tickless": they stop their hardclock interrupt until
+ * they have something to do, and once every cpu is idle the timer
+ * device is set for the next timer deadline instead of the next
+ * tick.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,27 +66,74 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Timer wheel geometry. A tick is one LT_GRANULARITY period. Level 0
+ * has a slot for each of the next TW_L0SIZE ticks; level 1 has a slot
+ * for each of the next TW_L1SIZE runs of TW_L0SIZE ticks, which are
+ * redistributed ("cascaded") into level 0 as time reaches them.
+ * Anything further out goes on a single list that is redistributed
+ * each time level 1 wraps around.
+ *
+ * Timers whose tick has arrived but whose deadline hasn't go on the
+ * "soon" list, where each interrupt checks them.
  */
-static struct wchan *lbolt;
+#define TICK_NSECS	((uint64_t)LT_GRANULARITY * 1000)
+#define TW_L0BITS	6
+#define TW_L0SIZE	(1 << TW_L0BITS)
+#define TW_L1BITS	6
+#define TW_L1SIZE	(1 << TW_L1BITS)
+
+/* Don't bother programming the device for less than this. */
+#define TIMER_MINUSECS	20
+
+/* Longest the timer device is left alone when everything's idle. */
+#define TIMER_MAXIDLE	((uint64_t)10 * 1000000000)
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	uint64_t tw_tick;		/* next tick to process */
+	struct timer *tw_l0[TW_L0SIZE];
+	struct timer *tw_l1[TW_L1SIZE];
+	struct timer *tw_far;
+	struct timer *tw_soon;
+	struct timer *tw_running;	/* timer whose function is running */
+	unsigned tw_count;		/* number of pending timers */
+
+	/* Tickless idle state; only touched by the wheel's own cpu */
+	bool tw_tickless;		/* hardclock is stopped */
+	uint64_t tw_idlestart;		/* when it was stopped */
+	unsigned tw_hcavoided;		/* hardclocks not taken */
+};
+
+static struct timerwheel *timerwheels[MAXCPUS];
+static unsigned timerwheel_count;
+
 /*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * When the timer device is next due to interrupt, and the lock that
+ * protects that and the device itself.
  */
-static struct wchan *minibolt;
+static struct spinlock timer_hwlock = SPINLOCK_INITIALIZER;
+static uint64_t timer_hwnext;
 
-/* 
- * number of minibolts per second
+/*
+ * Tickless bookkeeping, also under timer_hwlock: how many cpus are
+ * idle, when timerclock first ran (before that gettime() may not
+ * work), the last tick timerclock saw, and how many ticks it missed
+ * because the device was set further out.
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static unsigned timer_idlecpus;
+static uint64_t timer_startnsecs;
+static uint64_t timer_lasttick;
+static unsigned timer_ltavoided;
 
 /*
- * minibolt countdown
+ * Threads in clocksleep and friends sleep here. Normally only the
+ * sleepers' timeouts wake them; clocksleep_interrupt wakes everyone
+ * so threads of an exiting process can notice.
  */
-static int minicount;
+static struct wchan *sleepers;
 
 /*
  * Setup.
@@ -79,33 +141,559 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	sleepers = wchan_create("clocksleep");
+	if (sleepers == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
+	}
+}
+
+/*
+ * Create the timer wheel for a cpu. Called from cpu_create.
+ */
+void
+timerwheel_create(unsigned cpunum)
+{
+	struct timerwheel *tw;
+	unsigned i;
+
+	KASSERT(cpunum < MAXCPUS);
+	KASSERT(timerwheels[cpunum] == NULL);
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		panic("timerwheel_create: Out of memory\n");
+	}
+	spinlock_init(&tw->tw_lock);
+	/* tw_tick is set when the wheel is first used */
+	tw->tw_tick = 0;
+	for (i=0; i<TW_L0SIZE; i++) {
+		tw->tw_l0[i] = NULL;
+	}
+	for (i=0; i<TW_L1SIZE; i++) {
+		tw->tw_l1[i] = NULL;
+	}
+	tw->tw_far = NULL;
+	tw->tw_soon = NULL;
+	tw->tw_running = NULL;
+	tw->tw_count = 0;
+	tw->tw_tickless = false;
+	tw->tw_idlestart = 0;
+	tw->tw_hcavoided = 0;
+
+	timerwheels[cpunum] = tw;
+	timerwheel_count++;
+}
+
+/*
+ * The current time as a single number.
+ */
+uint64_t
+clock_nsecs(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	if (!gettime_available()) {
+		/* Early in boot */
+		return 0;
+	}
+	gettime(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000 + nsecs;
+}
+
+/*
+ * Timer list handling. The lists are doubly linked through
+ * tm_next/tm_prevp so timers can be removed in constant time.
+ */
+static
+void
+timer_link(struct timer **head, struct timer *tm)
+{
+	tm->tm_next = *head;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = &tm->tm_next;
+	}
+	tm->tm_prevp = head;
+	*head = tm;
+}
+
+static
+void
+timer_unlink(struct timer *tm)
+{
+	*tm->tm_prevp = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = tm->tm_prevp;
+	}
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+}
+
+/*
+ * Put a timer in the right place in a wheel, relative to the wheel's
+ * current tick. Returns true if it went on the soon list.
+ */
+static
+bool
+timerwheel_place(struct timerwheel *tw, struct timer *tm)
+{
+	uint64_t tick;
+
+	KASSERT(spinlock_do_i_hold(&tw->tw_lock));
+
+	tick = tm->tm_when / TICK_NSECS;
+	if (tick < tw->tw_tick) {
+		/* Tick already here (or past); wait for the deadline. */
+		timer_link(&tw->tw_soon, tm);
+		return true;
+	}
+	if (tick - tw->tw_tick < TW_L0SIZE) {
+		timer_link(&tw->tw_l0[tick % TW_L0SIZE], tm);
+	}
+	else if (tick - tw->tw_tick < TW_L0SIZE * TW_L1SIZE) {
+		timer_link(&tw->tw_l1[(tick >> TW_L0BITS) % TW_L1SIZE], tm);
+	}
+	else {
+		timer_link(&tw->tw_far, tm);
+	}
+	return false;
+}
+
+/*
+ * Move every timer on a list back through timerwheel_place. Detach
+ * the list first; some of them may belong on it again.
+ */
+static
+void
+timerwheel_cascade(struct timerwheel *tw, struct timer **list)
+{
+	struct timer *tm, *old;
+
+	old = *list;
+	*list = NULL;
+	if (old != NULL) {
+		old->tm_prevp = &old;
+	}
+	while ((tm = old) != NULL) {
+		timer_unlink(tm);
+		timerwheel_place(tw, tm);
+	}
+}
+
+/*
+ * Set the timer device to interrupt at WHEN. Call with timer_hwlock.
+ */
+static
+void
+timer_program_locked(uint64_t when)
+{
+	uint64_t now;
+	uint32_t usecs;
+
+	KASSERT(spinlock_do_i_hold(&timer_hwlock));
+
+	timer_hwnext = when;
+	now = clock_nsecs();
+	usecs = when > now ? (when - now) / 1000 : 0;
+	if (usecs < TIMER_MINUSECS) {
+		usecs = TIMER_MINUSECS;
+	}
+	ltimer_settimerclock(usecs);
+}
+
+/*
+ * Ask for a timer interrupt no later than WHEN.
+ */
+static
+void
+timer_program(uint64_t when)
+{
+	spinlock_acquire(&timer_hwlock);
+	if (when < timer_hwnext) {
+		timer_program_locked(when);
+	}
+	spinlock_release(&timer_hwlock);
+}
+
+/*
+ * Prepare a timer. FUNC(DATA) will be called from the timer interrupt
+ * when it expires, so it must not sleep.
+ */
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+	tm->tm_when = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+	tm->tm_wheel = NULL;
+	tm->tm_lastwheel = NULL;
+}
+
+/*
+ * Start a timer that will expire NSECS nanoseconds from now. It goes
+ * on the current cpu's wheel, unless its function is running and is
+ * restarting it, in which case it stays on the wheel it's running
+ * from; that way timer_cancel only has one wheel to look at. The
+ * timer must not already be pending.
+ */
+void
+timer_start(struct timer *tm, uint64_t nsecs)
+{
+	struct timerwheel *tw;
+	uint64_t now;
+	bool soon;
+
+	KASSERT(tm->tm_wheel == NULL);
+
+	now = clock_nsecs();
+	tm->tm_when = now + nsecs;
+
+	tw = tm->tm_lastwheel;
+	if (tw != NULL) {
+		spinlock_acquire(&tw->tw_lock);
+		if (tw->tw_running != tm) {
+			spinlock_release(&tw->tw_lock);
+			tw = NULL;
+		}
+	}
+	if (tw == NULL) {
+		tw = timerwheels[curcpu->c_number];
+		KASSERT(tw != NULL);
+		spinlock_acquire(&tw->tw_lock);
+	}
+
+	if (tw->tw_tick == 0) {
+		tw->tw_tick = now / TICK_NSECS + 1;
+	}
+	tm->tm_wheel = tw;
+	tm->tm_lastwheel = tw;
+	tw->tw_count++;
+	soon = timerwheel_place(tw, tm);
+	spinlock_release(&tw->tw_lock);
+
+	if (soon) {
+		/* It's due before the next tick; make sure we notice. */
+		timer_program(tm->tm_when);
+	}
+}
+
+/*
+ * Stop a timer. Returns true if it was still pending. If the timer's
+ * function is running on another cpu, wait for it to finish, and stop
+ * the timer again if the function restarted it, so that once this
+ * returns the timer can be reused or freed.
+ *
+ * A pending or running timer is always on tm_lastwheel (see
+ * timer_start), so that's the only wheel we need to lock.
+ */
+bool
+timer_cancel(struct timer *tm)
+{
+	struct timerwheel *tw;
+	bool pending = false;
+
+	while (1) {
+		tw = tm->tm_lastwheel;
+		if (tw == NULL) {
+			/* Never started */
+			return false;
+		}
+		spinlock_acquire(&tw->tw_lock);
+		if (tm->tm_lastwheel != tw) {
+			/* Restarted elsewhere under us; retry */
+			spinlock_release(&tw->tw_lock);
+			continue;
+		}
+		if (tm->tm_wheel == tw) {
+			timer_unlink(tm);
+			tm->tm_wheel = NULL;
+			tw->tw_count--;
+			pending = true;
+		}
+		if (tw->tw_running == tm) {
+			/* Firing right now; wait for it. */
+			spinlock_release(&tw->tw_lock);
+			continue;
+		}
+		spinlock_release(&tw->tw_lock);
+		return pending;
+	}
+}
+
+/*
+ * Call an expired timer's function. TM has been removed from its list
+ * and the wheel is locked; the lock is released around the call. The
+ * timer stops being pending before the call, so the function can
+ * restart it, but stays tw_running until the call returns, so
+ * timer_cancel waits for it.
+ */
+static
+void
+timerwheel_fire(struct timerwheel *tw, struct timer *tm)
+{
+	tm->tm_wheel = NULL;
+	tw->tw_count--;
+	tw->tw_running = tm;
+	spinlock_release(&tw->tw_lock);
+
+	tm->tm_func(tm->tm_data);
+
+	spinlock_acquire(&tw->tw_lock);
+	/* TM may be gone already; only compare against it from now on. */
+	tw->tw_running = NULL;
+}
+
+/*
+ * Run a wheel up to time NOW: process each tick that has started,
+ * cascading and collecting timers into the soon list, then fire
+ * everything on the soon list that has expired. Returns the earliest
+ * deadline left on the soon list, or 0 if it's empty.
+ */
+static
+uint64_t
+timerwheel_run(struct timerwheel *tw, uint64_t now)
+{
+	uint64_t curtick, next;
+	struct timer *tm, *nexttm;
+	unsigned slot;
+
+	curtick = now / TICK_NSECS;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_tick == 0 || tw->tw_count == 0) {
+		/* Nothing to cascade; skip any ticks we slept through. */
+		tw->tw_tick = curtick;
+	}
+	while (tw->tw_tick <= curtick) {
+		slot = tw->tw_tick % TW_L0SIZE;
+		if (slot == 0) {
+			if (((tw->tw_tick >> TW_L0BITS) % TW_L1SIZE) == 0) {
+				timerwheel_cascade(tw, &tw->tw_far);
+			}
+			timerwheel_cascade(tw,
+			    &tw->tw_l1[(tw->tw_tick >> TW_L0BITS) % TW_L1SIZE]);
+		}
+		/* Advance first, so these all land on the soon list. */
+		tw->tw_tick++;
+		timerwheel_cascade(tw, &tw->tw_l0[slot]);
+	}
+
+	/*
+	 * Fire whatever has expired. The list can change while the
+	 * lock is dropped to run a timer, so start over after each.
+	 */
+ again:
+	for (tm = tw->tw_soon; tm != NULL; tm = nexttm) {
+		nexttm = tm->tm_next;
+		if (tm->tm_when <= now) {
+			timer_unlink(tm);
+			timerwheel_fire(tw, tm);
+			goto again;
+		}
+	}
+
+	next = 0;
+	for (tm = tw->tw_soon; tm != NULL; tm = tm->tm_next) {
+		if (next == 0 || tm->tm_when < next) {
+			next = tm->tm_when;
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+
+	return next;
+}
+
+/*
+ * Return the earliest deadline in a wheel, or 0 if it's empty.
+ */
+static
+uint64_t
+timerwheel_earliest(struct timerwheel *tw)
+{
+	uint64_t best;
+	struct timer *tm;
+	unsigned i;
+
+	best = 0;
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		spinlock_release(&tw->tw_lock);
+		return 0;
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+#define TW_SCAN(list) \
+	for (tm = (list); tm != NULL; tm = tm->tm_next) { \
+		if (best == 0 || tm->tm_when < best) { \
+			best = tm->tm_when; \
+		} \
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	TW_SCAN(tw->tw_soon);
+	for (i=0; i<TW_L0SIZE; i++) {
+		TW_SCAN(tw->tw_l0[i]);
+	}
+	for (i=0; i<TW_L1SIZE; i++) {
+		TW_SCAN(tw->tw_l1[i]);
+	}
+	TW_SCAN(tw->tw_far);
+#undef TW_SCAN
+	spinlock_release(&tw->tw_lock);
+
+	return best;
 }
 
 /*
- * This is called once every every LT_GRANULARITY usec, on one processor,
- * by the timer code.
+ * Called by the idle loop before idling. Stop this cpu's hardclock,
+ * and if this was the last busy cpu, push the timer device out to
+ * the next timer deadline.
+ */
+void
+clock_idle_enter(void)
+{
+	struct timerwheel *tw;
+	uint64_t now, when, earliest;
+	unsigned i;
+
+	tw = timerwheels[curcpu->c_number];
+	if (tw == NULL || tw->tw_tickless) {
+		return;
+	}
+
+	spinlock_acquire(&timer_hwlock);
+	if (timer_startnsecs == 0) {
+		/* Timers aren't running yet; keep ticking. */
+		spinlock_release(&timer_hwlock);
+		return;
+	}
+
+	now = clock_nsecs();
+	mainbus_hardclock_stop();
+	tw->tw_tickless = true;
+	tw->tw_idlestart = now;
+
+	timer_idlecpus++;
+	KASSERT(timer_idlecpus <= timerwheel_count);
+	if (timer_idlecpus == timerwheel_count) {
+		when = now + TIMER_MAXIDLE;
+		for (i=0; i<MAXCPUS; i++) {
+			if (timerwheels[i] == NULL) {
+				continue;
+			}
+			earliest = timerwheel_earliest(timerwheels[i]);
+			if (earliest != 0 && earliest < when) {
+				when = earliest;
+			}
+		}
+		timer_program_locked(when);
+	}
+	spinlock_release(&timer_hwlock);
+}
+
+/*
+ * Called by the idle loop when the cpu wakes up. Restart the
+ * hardclock, and the regular ticks of the timer device if everyone
+ * was idle, and count the interrupts we didn't take.
+ */
+void
+clock_idle_exit(void)
+{
+	struct timerwheel *tw;
+	uint64_t now, next;
+
+	tw = timerwheels[curcpu->c_number];
+	if (tw == NULL || !tw->tw_tickless) {
+		return;
+	}
+
+	spinlock_acquire(&timer_hwlock);
+	now = clock_nsecs();
+	mainbus_hardclock_start();
+	tw->tw_tickless = false;
+	tw->tw_hcavoided += (now - tw->tw_idlestart) / (1000000000 / HZ);
+
+	if (timer_idlecpus == timerwheel_count) {
+		next = (now / TICK_NSECS + 1) * TICK_NSECS;
+		if (next < timer_hwnext) {
+			timer_program_locked(next);
+		}
+	}
+	KASSERT(timer_idlecpus > 0);
+	timer_idlecpus--;
+	spinlock_release(&timer_hwlock);
+}
+
+/*
+ * Print how many timer interrupts tickless idle has saved.
+ */
+void
+clock_printstats(void)
+{
+	uint64_t secs;
+	unsigned i, total;
+
+	spinlock_acquire(&timer_hwlock);
+	secs = timer_startnsecs == 0 ? 0 :
+		(clock_nsecs() - timer_startnsecs) / 1000000000;
+	spinlock_release(&timer_hwlock);
+	if (secs == 0) {
+		secs = 1;
+	}
+
+	kprintf("%4s %12s %8s\n", "cpu", "hc avoided", "per sec");
+	total = timer_ltavoided;
+	for (i=0; i<MAXCPUS; i++) {
+		if (timerwheels[i] == NULL) {
+			continue;
+		}
+		kprintf("%4u %12u %8u\n", i, timerwheels[i]->tw_hcavoided,
+			(unsigned)(timerwheels[i]->tw_hcavoided / secs));
+		total += timerwheels[i]->tw_hcavoided;
+	}
+	kprintf("timer device: %u ticks avoided\n", timer_ltavoided);
+	kprintf("total: %u interrupts avoided, %u per second\n",
+		total, (unsigned)(total / secs));
+}
+
+/*
+ * This is called from the timer device interrupt, on one processor,
+ * at least once every LT_GRANULARITY usec and whenever a timer on a
+ * soon list comes due.
  */
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	uint64_t now, next, soonest;
+	unsigned i;
+
+	now = clock_nsecs();
+	next = (now / TICK_NSECS + 1) * TICK_NSECS;
+
+	/*
+	 * Forget the old deadline; timer_start may post new ones.
+	 * Count the ticks we skipped over while everyone was idle.
+	 */
+	spinlock_acquire(&timer_hwlock);
+	timer_hwnext = (uint64_t)-1;
+	if (timer_startnsecs == 0) {
+		timer_startnsecs = now;
+	}
+	else if (now / TICK_NSECS > timer_lasttick + 1) {
+		timer_ltavoided += now / TICK_NSECS - timer_lasttick - 1;
+	}
+	timer_lasttick = now / TICK_NSECS;
+	spinlock_release(&timer_hwlock);
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (timerwheels[i] == NULL) {
+			continue;
+		}
+		soonest = timerwheel_run(timerwheels[i], now);
+		if (soonest != 0 && soonest < next) {
+			next = soonest;
+		}
 	}
+
+	timer_program(next);
 }
 
 /*
@@ -120,13 +708,52 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
-		schedule();
+	if (!curcpu->c_isidle) {
+		curthread->t_stats.ss_runticks++;
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+
+	/* Charge the tick; this yields if the quantum is used up. */
+	schedule();
+}
+
+/*
+ * Suspend execution for NSECS nanoseconds, or until the current
+ * process starts exiting.
+ */
+int
+clocknanosleep(uint64_t nsecs)
+{
+	uint64_t deadline, now;
+
+	deadline = clock_nsecs() + nsecs;
+	while (1) {
+		now = clock_nsecs();
+		if (now >= deadline) {
+			break;
+		}
+		wchan_lock(sleepers);
+		/* Checked under the channel lock; see clocksleep_interrupt */
+		if (uthread_exiting()) {
+			wchan_unlock(sleepers);
+			return EINTR;
+		}
+		wchan_sleep_timeout(sleepers, deadline - now);
+	}
+	return 0;
+}
+
+/*
+ * Wake everyone in clocknanosleep. Those whose process is exiting
+ * return; the rest find their deadline hasn't passed and go back to
+ * sleep. Called by uthread_exitall after setting p_exiting.
+ */
+void
+clocksleep_interrupt(void)
+{
+	wchan_wakeall(sleepers);
 }
 
 /*
@@ -135,11 +762,9 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		clocknanosleep((uint64_t)num_secs * 1000000000);
+	}
 }
 
 /*
@@ -149,9 +774,7 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks > 0) {
+		clocknanosleep((uint64_t)num_ticks * TICK_NSECS);
+	}
 }
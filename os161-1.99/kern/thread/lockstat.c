@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock contention statistics.
+ *
+ * The counters live in a fixed-size hash table; if it fills up,
+ * further locks are lumped together in an overflow entry. Because
+ * spinlock_acquire reports here, the table can't be protected by a
+ * spinlock; it gets a bare test-and-set lock of its own, taken with
+ * interrupts off. For the same reason nothing in here may print,
+ * allocate, or otherwise take locks while holding it.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NENTRIES  128	/* must be a power of 2 */
+#define LOCKSTAT_NAMELEN   24
+
+struct lockstat {
+	int ls_kind;			/* LOCKSTAT_*, or -1 if unused */
+	const void *ls_addr;		/* spinlock address */
+	char ls_name[LOCKSTAT_NAMELEN];	/* lock or cv name */
+	unsigned ls_acquires;		/* acquisitions (waits, for cvs) */
+	unsigned ls_contended;		/* acquisitions that had to wait */
+	uint64_t ls_spins;		/* trips around spin loops */
+	uint64_t ls_waitnsecs;		/* time spent asleep */
+	uint64_t ls_maxholdnsecs;	/* longest time held */
+};
+
+/* The extra entry at the end is the overflow bucket. */
+static struct lockstat lockstat_table[LOCKSTAT_NENTRIES+1];
+static bool lockstat_ready;
+static volatile spinlock_data_t lockstat_word = SPINLOCK_DATA_INITIALIZER;
+
+/*
+ * Lock and unlock the table.
+ */
+static
+int
+lockstat_lock(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockstat_word) != 0 ||
+	       spinlock_data_testandset(&lockstat_word) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockstat_unlock(int spl)
+{
+	spinlock_data_set(&lockstat_word, 0);
+	splx(spl);
+}
+
+/*
+ * Clear the table. Call with it locked.
+ */
+static
+void
+lockstat_clear(void)
+{
+	unsigned i;
+
+	bzero(lockstat_table, sizeof(lockstat_table));
+	for (i=0; i<LOCKSTAT_NENTRIES; i++) {
+		lockstat_table[i].ls_kind = -1;
+	}
+	/* The overflow bucket */
+	lockstat_table[LOCKSTAT_NENTRIES].ls_kind = LOCKSTAT_LOCK;
+	strcpy(lockstat_table[LOCKSTAT_NENTRIES].ls_name, "(others)");
+	lockstat_ready = true;
+}
+
+static
+unsigned
+lockstat_hash(int kind, const void *addr, const char *name)
+{
+	uint32_t h;
+
+	if (kind == LOCKSTAT_SPINLOCK) {
+		/* Fibonacci hashing; the low bits of addresses are boring. */
+		return ((uint32_t)addr * 2654435761U) >> 7 &
+			(LOCKSTAT_NENTRIES - 1);
+	}
+	h = kind;
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h & (LOCKSTAT_NENTRIES - 1);
+}
+
+/*
+ * Compare NAME with an entry's name, which may have been truncated.
+ */
+static
+bool
+lockstat_samename(const struct lockstat *ls, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN - 1; i++) {
+		if (ls->ls_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find (or make) the entry for a lock. Call with the table locked.
+ */
+static
+struct lockstat *
+lockstat_find(int kind, const void *addr, const char *name)
+{
+	struct lockstat *ls;
+	unsigned i, j, n;
+
+	if (!lockstat_ready) {
+		lockstat_clear();
+	}
+	if (kind != LOCKSTAT_SPINLOCK) {
+		addr = NULL;
+	}
+
+	i = lockstat_hash(kind, addr, name);
+	for (n=0; n<LOCKSTAT_NENTRIES; n++) {
+		ls = &lockstat_table[i];
+		if (ls->ls_kind == -1) {
+			ls->ls_kind = kind;
+			ls->ls_addr = addr;
+			if (addr == NULL) {
+				for (j=0; j<LOCKSTAT_NAMELEN - 1 &&
+					     name[j] != 0; j++) {
+					ls->ls_name[j] = name[j];
+				}
+			}
+			return ls;
+		}
+		if (ls->ls_kind == kind && ls->ls_addr == addr &&
+		    (addr != NULL || lockstat_samename(ls, name))) {
+			return ls;
+		}
+		i = (i+1) % LOCKSTAT_NENTRIES;
+	}
+
+	/* Table full; use the overflow bucket. */
+	return &lockstat_table[LOCKSTAT_NENTRIES];
+}
+
+void
+lockstat_acquire(int kind, const void *addr, const char *name,
+		 bool contended, unsigned spins, uint64_t waitnsecs)
+{
+	struct lockstat *ls;
+	int spl;
+
+	spl = lockstat_lock();
+	ls = lockstat_find(kind, addr, name);
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+	}
+	ls->ls_spins += spins;
+	ls->ls_waitnsecs += waitnsecs;
+	lockstat_unlock(spl);
+}
+
+void
+lockstat_release(int kind, const void *addr, const char *name,
+		 uint64_t holdnsecs)
+{
+	struct lockstat *ls;
+	int spl;
+
+	spl = lockstat_lock();
+	ls = lockstat_find(kind, addr, name);
+	if (holdnsecs > ls->ls_maxholdnsecs) {
+		ls->ls_maxholdnsecs = holdnsecs;
+	}
+	lockstat_unlock(spl);
+}
+
+void
+lockstat_reset(void)
+{
+	int spl;
+
+	spl = lockstat_lock();
+	lockstat_clear();
+	lockstat_unlock(spl);
+}
+
+/*
+ * Print the MAX most contended locks. We can't print with the table
+ * locked, so work from a copy.
+ */
+void
+lockstat_print(unsigned max)
+{
+	static const char *const kinds[] = { "spin", "lock", "cv" };
+	struct lockstat *copy, *ls;
+	unsigned i, n, best;
+	int spl;
+
+	copy = kmalloc(sizeof(lockstat_table));
+	if (copy == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+	spl = lockstat_lock();
+	if (!lockstat_ready) {
+		lockstat_clear();
+	}
+	memcpy(copy, lockstat_table, sizeof(lockstat_table));
+	lockstat_unlock(spl);
+
+	kprintf("%-4s %-24s %9s %9s %10s %9s %9s\n", "kind", "name",
+		"acquires", "contended", "spins", "wait ms", "maxhold us");
+	for (n=0; n<max; n++) {
+		/* Find the most contended that's left */
+		best = LOCKSTAT_NENTRIES + 1;
+		for (i=0; i<=LOCKSTAT_NENTRIES; i++) {
+			if (copy[i].ls_kind != -1 && copy[i].ls_acquires > 0 &&
+			    (best > LOCKSTAT_NENTRIES ||
+			     copy[i].ls_contended > copy[best].ls_contended)) {
+				best = i;
+			}
+		}
+		if (best > LOCKSTAT_NENTRIES) {
+			break;
+		}
+		ls = &copy[best];
+		if (ls->ls_kind == LOCKSTAT_SPINLOCK) {
+			snprintf(ls->ls_name, sizeof(ls->ls_name), "%p",
+				 ls->ls_addr);
+		}
+		kprintf("%-4s %-24s %9u %9u %10llu %9llu %9llu\n",
+			kinds[ls->ls_kind], ls->ls_name,
+			ls->ls_acquires, ls->ls_contended, ls->ls_spins,
+			ls->ls_waitnsecs / 1000000,
+			ls->ls_maxholdnsecs / 1000);
+		/* Don't pick it again */
+		ls->ls_kind = -1;
+	}
+
+	kfree(copy);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Read-copy-update. See rcu.h for the interface.
+ *
+ * Grace periods are tracked with a single counter, rcu_gen. Each
+ * rcu_free bumps it and stamps the object with the new value; each
+ * cpu copies the counter into c_rcugen whenever it goes through
+ * thread_switch, and on each hardclock. Read sections run with
+ * interrupts off and can't sleep, so neither can happen inside one;
+ * once every cpu that isn't idle has copied a value at least as new
+ * as an object's stamp, nobody can still be reading the object.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <rcu.h>
+
+volatile unsigned rcu_gen;
+
+/* Objects waiting to be freed, oldest first. */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct rcu_head *rcu_pending;
+static struct rcu_head **rcu_pendingtail = &rcu_pending;
+
+/* True if grace period GEN is over, given the oldest gen still seen */
+#define RCU_DONE(gen, seen)	((int)((seen) - (gen)) >= 0)
+
+void
+rcu_read_lock(void)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	curthread->t_rcudepth++;
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcudepth > 0);
+	curthread->t_rcudepth--;
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Start a new grace period and return its number.
+ */
+static
+unsigned
+rcu_newgen(void)
+{
+	unsigned gen;
+
+	spinlock_acquire(&rcu_lock);
+	gen = ++rcu_gen;
+	spinlock_release(&rcu_lock);
+	return gen;
+}
+
+/*
+ * Free whatever's pending whose grace period is over.
+ */
+static
+void
+rcu_reclaim(void)
+{
+	struct rcu_head *done, *rh;
+	unsigned seen;
+
+	seen = cpu_rcuseen(rcu_gen);
+
+	spinlock_acquire(&rcu_lock);
+	done = rcu_pending;
+	rh = NULL;
+	while (rcu_pending != NULL && RCU_DONE(rcu_pending->rh_gen, seen)) {
+		rh = rcu_pending;
+		rcu_pending = rh->rh_next;
+	}
+	if (rh == NULL) {
+		done = NULL;
+	}
+	else {
+		rh->rh_next = NULL;
+	}
+	if (rcu_pending == NULL) {
+		rcu_pendingtail = &rcu_pending;
+	}
+	spinlock_release(&rcu_lock);
+
+	while (done != NULL) {
+		rh = done;
+		done = rh->rh_next;
+		kfree(rh->rh_ptr);
+	}
+}
+
+void
+rcu_free(struct rcu_head *rh, void *ptr)
+{
+	KASSERT(curthread->t_rcudepth == 0);
+
+	rh->rh_next = NULL;
+	rh->rh_ptr = ptr;
+
+	spinlock_acquire(&rcu_lock);
+	rh->rh_gen = ++rcu_gen;
+	*rcu_pendingtail = rh;
+	rcu_pendingtail = &rh->rh_next;
+	spinlock_release(&rcu_lock);
+
+	rcu_reclaim();
+}
+
+void
+rcu_synchronize(void)
+{
+	unsigned gen;
+
+	KASSERT(curthread->t_rcudepth == 0);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	gen = rcu_newgen();
+	while (!RCU_DONE(gen, cpu_rcuseen(gen))) {
+		/* Busy cpus check in at least once a tick */
+		clocknap(1);
+	}
+	rcu_reclaim();
+}
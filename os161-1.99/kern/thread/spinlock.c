@@ -36,11 +36,38 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <clock.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
+ *
+ * By default these are test-and-test-and-set locks, which back off
+ * exponentially after losing a race for the lock so the contending
+ * cpus don't keep hammering the same cache line. With the ticketlock
+ * option they are ticket locks instead, which hand the lock out in
+ * FIFO order; a waiter backs off in proportion to how many cpus are
+ * ahead of it in line.
  */
 
+/* Backoff bounds, in trips around spinlock_backoff's loop */
+#define SPINLOCK_BACKOFF_MIN	4
+#define SPINLOCK_BACKOFF_MAX	1024
+
+/*
+ * Spin for a while without touching the lock word.
+ */
+static
+void
+spinlock_backoff(unsigned count)
+{
+	volatile unsigned i;
+
+	for (i=0; i<count; i++) {
+		/* nothing */
+	}
+}
+
 
 /*
  * Initialize spinlock.
@@ -59,7 +86,11 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
+#if OPT_TICKETLOCK
+	KASSERT(!spinlock_data_isheld(&lk->lk_lock));
+#else
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+#endif
 }
 
 /*
@@ -73,6 +104,12 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	unsigned spins = 0;
+#if OPT_TICKETLOCK
+	unsigned ticket, serving;
+#else
+	unsigned backoff;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,6 +124,23 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+#if OPT_TICKETLOCK
+	/*
+	 * Take a ticket and wait for it to come up. The further back
+	 * in line we are, the longer we can wait between looks.
+	 */
+	ticket = spinlock_data_taketicket(&lk->lk_lock);
+	while (1) {
+		serving = spinlock_data_serving(&lk->lk_lock);
+		if (serving == ticket) {
+			break;
+		}
+		spins++;
+		spinlock_backoff(SPINLOCK_BACKOFF_MIN *
+			(((ticket - serving) & SPINLOCK_TICKET_MASK) - 1));
+	}
+#else
+	backoff = SPINLOCK_BACKOFF_MIN;
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -97,17 +151,34 @@ spinlock_acquire(struct spinlock *lk)
 		 * previous value. If that value was 0, the lock was
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
+		 *
+		 * If we lose the race for the lock, somebody else
+		 * has it; back off before looking again, for twice
+		 * as long each time.
 		 */
 		if (spinlock_data_get(&lk->lk_lock) != 0) {
+			spins++;
 			continue;
 		}
 		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+			spins++;
+			spinlock_backoff(backoff);
+			if (backoff < SPINLOCK_BACKOFF_MAX) {
+				backoff *= 2;
+			}
 			continue;
 		}
 		break;
 	}
+#endif
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	lockstat_acquire(LOCKSTAT_SPINLOCK, lk, NULL, spins > 0, spins, 0);
+	lk->lk_acquiredat = clock_nsecs();
+#else
+	(void)spins;
+#endif
 }
 
 /*
@@ -121,8 +192,16 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_release(LOCKSTAT_SPINLOCK, lk, NULL,
+			 clock_nsecs() - lk->lk_acquiredat);
+#endif
 	lk->lk_holder = NULL;
+#if OPT_TICKETLOCK
+	spinlock_data_nextticket(&lk->lk_lock);
+#else
 	spinlock_data_set(&lk->lk_lock, 0);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -33,12 +33,18 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <clock.h>
+#include <syscall.h>
 #include <synch.h>
+#include <kmem_cache.h>
+#include <lockstat.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -129,6 +135,84 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * P, but give up after NSECS nanoseconds. Returns 0 if the semaphore
+ * was decremented, or ETIMEDOUT.
+ */
+int
+P_timed(struct semaphore *sem, uint64_t nsecs)
+{
+	uint64_t deadline, now;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	deadline = clock_nsecs() + nsecs;
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		now = clock_nsecs();
+		if (now >= deadline) {
+			spinlock_release(&sem->sem_lock);
+			return ETIMEDOUT;
+		}
+		/* As in P. */
+		wchan_lock(sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+		wchan_sleep_timeout(sem->sem_wchan, deadline - now);
+
+		spinlock_acquire(&sem->sem_lock);
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
+/*
+ * P, but give up with EINTR if the current process starts exiting.
+ */
+int
+P_intr(struct semaphore *sem)
+{
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		/* Checked under sem_lock; see sem_interrupt */
+		if (uthread_exiting()) {
+			spinlock_release(&sem->sem_lock);
+			return EINTR;
+		}
+		/* As in P. */
+		wchan_lock(sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+		wchan_sleep(sem->sem_wchan);
+
+		spinlock_acquire(&sem->sem_lock);
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
+/*
+ * Wake everyone waiting on SEM without changing the count. Those in
+ * P_intr whose process is exiting give up; everyone else goes back
+ * to sleep.
+ */
+void
+sem_interrupt(struct semaphore *sem)
+{
+	KASSERT(sem != NULL);
+
+	spinlock_acquire(&sem->sem_lock);
+	wchan_wakeall(sem->sem_wchan);
+	spinlock_release(&sem->sem_lock);
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -147,19 +231,230 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks and CVs come from object caches. A cached lock keeps its
+ * spinlock initialized and is always unowned.
+ */
+static
+int
+lock_ctor(void *obj)
+{
+        struct lock *lock = obj;
+
+        spinlock_init(&lock->lk_spinlock);
+        lock->lk_owner = NULL;
+        bzero(lock->lk_waiters, sizeof(lock->lk_waiters));
+        lock->lk_nblocked = 0;
+        lock->lk_heldnext = NULL;
+        return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+        struct lock *lock = obj;
+
+        spinlock_cleanup(&lock->lk_spinlock);
+}
+
+static struct kmem_cache lock_cache =
+        KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock),
+                               lock_ctor, lock_dtor);
+static struct kmem_cache cv_cache =
+        KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), NULL, NULL);
+
+/*
+ * Wait morphing for cvs; see synch.h.
+ */
+bool cv_waitmorph = true;
+
+/*
+ * Spin limit for adaptive locks; see synch.h.
+ */
+unsigned lock_spinlimit = LOCK_SPINLIMIT;
+
+/*
+ * Priority inheritance; see synch.h. All the inheritance state (the
+ * t_inherited, t_blockedon, and t_blockedlevel fields of threads,
+ * lk_waiters and lk_nblocked of locks) is protected by lock_pilock.
+ * Waiters are counted under their lock's lk_spinlock as well, and
+ * lk_owner of a lock with counted waiters only changes while holding
+ * lock_pilock too, so following a chain of owners under lock_pilock
+ * never sees an owner that already let go.
+ *
+ * Lock order: lk_spinlock, then lock_pilock, then run queue locks.
+ */
+bool lock_inheritance = true;
+static struct spinlock lock_pilock = SPINLOCK_INITIALIZER;
+
+/* Best level among LOCK's sleeping waiters, or MLFQ_NLEVELS. */
+static
+unsigned
+lock_waitlevel(struct lock *lock)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+	for (i=0; i<MLFQ_NLEVELS; i++) {
+		if (lock->lk_waiters[i] > 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Lend LEVEL to thread T, and on down the chain of locks and owners
+ * it's waiting for. Stop at a thread that's already at least that
+ * good, which also stops a deadlock cycle from going around forever.
+ */
+static
+void
+lock_lend(struct thread *t, unsigned level)
+{
+	struct lock *lock;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+	while (t != NULL && level < THREAD_PRIORITY(t)) {
+		thread_inherit(t, level);
+		lock = t->t_blockedon;
+		if (lock == NULL) {
+			break;
+		}
+		/* Recount T at its new level. */
+		lock->lk_waiters[t->t_blockedlevel]--;
+		lock->lk_waiters[level]++;
+		t->t_blockedlevel = level;
+		t = lock->lk_owner;
+	}
+}
+
+/*
+ * Going to sleep waiting for LOCK, which OWNER holds: get counted as
+ * a waiter and lend OWNER our level.
+ */
+static
+void
+lock_block(struct lock *lock, struct thread *owner)
+{
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	spinlock_acquire(&lock_pilock);
+	level = THREAD_PRIORITY(curthread);
+	curthread->t_blockedon = lock;
+	curthread->t_blockedlevel = level;
+	lock->lk_waiters[level]++;
+	lock->lk_nblocked++;
+	lock_lend(owner, level);
+	spinlock_release(&lock_pilock);
+}
+
+/* Done waiting for LOCK; stop being counted. */
+static
+void
+lock_unblock(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	KASSERT(curthread->t_blockedon == lock);
+	spinlock_acquire(&lock_pilock);
+	lock->lk_waiters[curthread->t_blockedlevel]--;
+	lock->lk_nblocked--;
+	curthread->t_blockedon = NULL;
+	spinlock_release(&lock_pilock);
+}
+
+/*
+ * The current thread just got LOCK (we hold lk_spinlock). Remember
+ * that, and inherit from anyone still asleep waiting for it.
+ */
+static
+void
+lock_held(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	lock->lk_heldnext = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+	if (lock->lk_nblocked > 0) {
+		spinlock_acquire(&lock_pilock);
+		lock_lend(curthread, lock_waitlevel(lock));
+		spinlock_release(&lock_pilock);
+	}
+}
+
+/*
+ * Work out what the current thread should still be inheriting, from
+ * the sleepers on the locks it holds.
+ */
+static
+void
+lock_reinherit(void)
+{
+	struct lock *held;
+	unsigned level, best = MLFQ_NLEVELS;
+
+	KASSERT(spinlock_do_i_hold(&lock_pilock));
+	for (held = curthread->t_heldlocks; held != NULL;
+	     held = held->lk_heldnext) {
+		level = lock_waitlevel(held);
+		if (level < best) {
+			best = level;
+		}
+	}
+	if (best != curthread->t_inherited) {
+		thread_inherit(curthread, best);
+	}
+}
+
+/* True if thread T is on a cpu right now, and it isn't this one. */
+#define LOCK_OWNER_RUNNING(t) \
+	((t)->t_state == S_RUN && (t)->t_cpu != curcpu->c_self)
+
+/*
+ * Spin while LOCK is held by OWNER and OWNER is running on another
+ * cpu, for up to lock_spinlimit tries. Returns false if we ran out of
+ * tries, true if it's worth trying for the lock again.
+ *
+ * Nothing is locked while we spin, so OWNER may change state, or even
+ * exit, underneath us. That's all right: thread structures are never
+ * unmapped, and a stale look at one just means we spin a bit longer
+ * or give up a bit sooner.
+ */
+static
+bool
+lock_spin(struct lock *lock, struct thread *owner, unsigned *spins)
+{
+	volatile struct thread *vowner = owner;
+	unsigned i;
+
+	for (i=0; i<lock_spinlimit; i++) {
+		(*spins)++;
+		if (lock->lk_owner != owner) {
+			return true;
+		}
+		if (!LOCK_OWNER_RUNNING(vowner)) {
+			/* Owner went to sleep; if it's still ours, block. */
+			return lock->lk_owner != owner;
+		}
+	}
+	return false;
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        COMPILE_ASSERT(LOCK_NLEVELS == MLFQ_NLEVELS);
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL) {
             return NULL;
         }
 
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
     
@@ -167,12 +462,13 @@ lock_create(const char *name)
     lock->lk_wchan = wchan_create(lock->lk_name);
     if (lock->lk_wchan == NULL) {
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(&lock_cache, lock);
         return NULL;
     }
 
-    spinlock_init(&lock->lk_spinlock);
-        lock->lk_owner = NULL; // no one owns the lock at the very beginning
+        /* lk_spinlock and lk_owner are set up by lock_ctor */
+        KASSERT(lock->lk_owner == NULL); // no one owns the lock at the very beginning
+        lock->lk_handoff = false;
         return lock;
 }
 
@@ -182,44 +478,133 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
         // add stuff here as needed
-        /* wchan_cleanup will assert if anyone's waiting on it */
-        spinlock_cleanup(&lock->lk_spinlock);
+        /* wchan_destroy will assert if anyone's waiting on it */
+        KASSERT(lock->lk_owner == NULL);
+        KASSERT(lock->lk_nblocked == 0);
         wchan_destroy(lock->lk_wchan); // every resource(lock) has their own wchan
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(&lock_cache, lock);
 }
 
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *owner;
+        bool spin;
+        unsigned spins = 0;
+#if OPT_LOCKSTAT
+        uint64_t sleepstart, slept = 0;
+        bool contended = lock->lk_owner != NULL;
+#endif
+
         // Write this
         KASSERT(!(lock_do_i_hold(lock))); // if I want to acquire the lock, I can not hold the lock before
     
         spinlock_acquire(&lock->lk_spinlock);
-        while (!(lock->lk_owner == NULL)) {
+        /* In handoff mode lock_release may already have made us owner. */
+        while (!(lock->lk_owner == NULL || lock->lk_owner == curthread)) {
+            owner = lock->lk_owner;
+            if (lock_spinlimit > 0 && LOCK_OWNER_RUNNING(owner)) {
+                /* Probably about to be released; spin, don't sleep. */
+                spinlock_release(&lock->lk_spinlock);
+                spin = lock_spin(lock, owner, &spins);
+                spinlock_acquire(&lock->lk_spinlock);
+                if (spin || lock->lk_owner == NULL) {
+                    continue;
+                }
+            }
+            if (lock_inheritance) {
+                lock_block(lock, lock->lk_owner);
+            }
             wchan_lock(lock->lk_wchan);
             spinlock_release(&lock->lk_spinlock);
+#if OPT_LOCKSTAT
+            sleepstart = clock_nsecs();
             wchan_sleep(lock->lk_wchan);
+            slept += clock_nsecs() - sleepstart;
+#else
+            wchan_sleep(lock->lk_wchan);
+#endif
             spinlock_acquire(&lock->lk_spinlock);
+            if (curthread->t_blockedon != NULL) {
+                lock_unblock(lock);
+            }
         }
         lock->lk_owner=curthread;  // set the owner of the lock to be current thread
+        lock_held(lock);
         spinlock_release(&lock->lk_spinlock);
 
+#if OPT_LOCKSTAT
+        contended = contended || spins > 0 || slept > 0;
+        lockstat_acquire(LOCKSTAT_LOCK, lock, lock->lk_name, contended,
+                         spins, slept);
+        lock->lk_acquiredat = clock_nsecs();
+#else
+        (void)spins;
+#endif
+
         // (void)lock;  // suppress warning until code gets written
 }
 
 void
 lock_release(struct lock *lock)
 {
+        struct lock **heldp;
+        bool pi;
+
         // Write this
         KASSERT(lock_do_i_hold(lock)); // I need to be the owner of the lock
+#if OPT_LOCKSTAT
+        lockstat_release(LOCKSTAT_LOCK, lock, lock->lk_name,
+                         clock_nsecs() - lock->lk_acquiredat);
+#endif
         spinlock_acquire(&lock->lk_spinlock);
-        lock->lk_owner = NULL;
-        wchan_wakeone(lock->lk_wchan);
+        for (heldp = &curthread->t_heldlocks; *heldp != lock;
+             heldp = &(*heldp)->lk_heldnext) {
+            KASSERT(*heldp != NULL);
+        }
+        *heldp = lock->lk_heldnext;
+        lock->lk_heldnext = NULL;
+
+        /*
+         * If anyone might be following lk_owner, or we've been lent
+         * a level that may have come through this lock, we need the
+         * inheritance lock.
+         */
+        pi = lock->lk_nblocked > 0 || curthread->t_inherited < MLFQ_NLEVELS;
+        if (pi) {
+            spinlock_acquire(&lock_pilock);
+        }
+        if (lock->lk_handoff) {
+            /*
+             * Give the lock straight to the head waiter. It can't
+             * look at lk_owner until we drop lk_spinlock, so it's
+             * safe to hang onto the pointer until then.
+             */
+            lock->lk_owner = wchan_wakehead(lock->lk_wchan);
+        }
+        else {
+            lock->lk_owner = NULL;
+            wchan_wakeone(lock->lk_wchan);
+        }
+        if (pi) {
+            lock_reinherit();
+            spinlock_release(&lock_pilock);
+        }
         spinlock_release(&lock->lk_spinlock);
         //(void)lock;  // suppress warning until code gets written
 }
 
+void
+lock_sethandoff(struct lock *lock, bool handoff)
+{
+        KASSERT(lock != NULL);
+
+        spinlock_acquire(&lock->lk_spinlock);
+        lock->lk_handoff = handoff;
+        spinlock_release(&lock->lk_spinlock);
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -242,14 +627,14 @@ cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
         
@@ -257,7 +642,7 @@ cv_create(const char *name)
     cv->cv_wchan = wchan_create(cv->cv_name);
     if (cv->cv_wchan == NULL){
         kfree(cv->cv_name);
-        kfree(cv);
+        kmem_cache_free(&cv_cache, cv);
         return NULL;
     }
 
@@ -274,7 +659,35 @@ cv_destroy(struct cv *cv)
         wchan_destroy(cv->cv_wchan);
         
         kfree(cv->cv_name);
-        kfree(cv);
+        kmem_cache_free(&cv_cache, cv);
+}
+
+/*
+ * Get the lock back after sleeping on a cv. If we were moved onto the
+ * lock's wait channel and the lock is in handoff mode, lock_release
+ * has already made us the owner. lk_owner is set while holding
+ * lk_spinlock, which might not be released yet; so take it to look.
+ */
+static
+void
+cv_relock(struct lock *lock)
+{
+        bool mine;
+
+        spinlock_acquire(&lock->lk_spinlock);
+        mine = lock->lk_owner == curthread;
+        if (mine) {
+            lock_held(lock);
+        }
+        spinlock_release(&lock->lk_spinlock);
+        if (!mine) {
+            lock_acquire(lock);
+        }
+#if OPT_LOCKSTAT
+        else {
+            lock->lk_acquiredat = clock_nsecs();
+        }
+#endif
 }
 
 void
@@ -282,20 +695,58 @@ cv_wait(struct cv *cv, struct lock *lock)
 {       
         // Write this
         KASSERT(lock_do_i_hold(lock)); // I need to be the owner of the lock before release
+#if OPT_LOCKSTAT
+        uint64_t start = clock_nsecs();
+#endif
         wchan_lock(cv->cv_wchan);
         lock_release(lock);
         wchan_sleep(cv->cv_wchan);
-        lock_acquire(lock);
+        cv_relock(lock);
+#if OPT_LOCKSTAT
+        lockstat_acquire(LOCKSTAT_CV, cv, cv->cv_name, true, 0,
+                         clock_nsecs() - start);
+#endif
         //(void)cv;    // suppress warning until code gets written
         //(void)lock;  // suppress warning until code gets written
 }
 
+/*
+ * cv_wait, but give up after NSECS nanoseconds. The lock is held
+ * again on return either way. Returns 0 if woken by cv_signal or
+ * cv_broadcast, or ETIMEDOUT.
+ */
+int
+cv_timedwait(struct cv *cv, struct lock *lock, uint64_t nsecs)
+{
+	int result;
+#if OPT_LOCKSTAT
+	uint64_t start = clock_nsecs();
+#endif
+
+	KASSERT(lock_do_i_hold(lock));
+	wchan_lock(cv->cv_wchan);
+	lock_release(lock);
+	result = wchan_sleep_timeout(cv->cv_wchan, nsecs);
+	cv_relock(lock);
+#if OPT_LOCKSTAT
+	lockstat_acquire(LOCKSTAT_CV, cv, cv->cv_name, true, 0,
+			 clock_nsecs() - start);
+#endif
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
         // Write this
     KASSERT(lock_do_i_hold(lock)); // i need to be the owner of the lock, so that I can call thread_yield
-    wchan_wakeone(cv->cv_wchan);
+    if (cv_waitmorph) {
+        /* We hold the lock, so it'll be released (and wake them) later. */
+        wchan_requeue(cv->cv_wchan, lock->lk_wchan, false);
+    }
+    else {
+        wchan_wakeone(cv->cv_wchan);
+    }
 	//(void)cv;    // suppress warning until code gets written
 	//(void)lock;  // suppress warning until code gets written
 }
@@ -305,7 +756,357 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 {
 	// Write this
     KASSERT(lock_do_i_hold(lock));
-    wchan_wakeall(cv->cv_wchan);
+    if (cv_waitmorph) {
+        wchan_requeue(cv->cv_wchan, lock->lk_wchan, true);
+    }
+    else {
+        wchan_wakeall(cv->cv_wchan);
+    }
 	//(void)cv;    // suppress warning until code gets written
 	//(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_waitreaders = 0;
+	rw->rw_waitwriters = 0;
+	rw->rw_gen = 0;
+	rw->rw_writer = NULL;
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+
+	/* wchan_destroy will assert if anyone's waiting */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_writer == NULL && rw->rw_waitwriters == 0) {
+		rw->rw_readers++;
+		spinlock_release(&rw->rw_lock);
+		return;
+	}
+
+	/*
+	 * Wait for the next writer to let us in. It counts us into
+	 * rw_readers on its way out, and bumps rw_gen to tell us.
+	 */
+	gen = rw->rw_gen;
+	rw->rw_waitreaders++;
+	do {
+		wchan_lock(rw->rw_readwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_readwchan);
+		spinlock_acquire(&rw->rw_lock);
+	} while (rw->rw_gen == gen);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+		wchan_wakeone(rw->rw_writewchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_waitwriters++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_lock(rw->rw_writewchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_writewchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_waitwriters--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rwlock_do_i_hold_write(rw));
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	if (rw->rw_waitreaders > 0) {
+		/* Readers that waited through us go next, together. */
+		rw->rw_readers = rw->rw_waitreaders;
+		rw->rw_waitreaders = 0;
+		rw->rw_gen++;
+		wchan_wakeall(rw->rw_readwchan);
+	}
+	else if (rw->rw_waitwriters > 0) {
+		wchan_wakeone(rw->rw_writewchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	return rw->rw_writer == curthread;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Barrier.
+
+struct barrier *
+barrier_create(const char *name, unsigned count)
+{
+	struct barrier *b;
+
+	KASSERT(count > 0);
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->b_name = kstrdup(name);
+	if (b->b_name == NULL) {
+		kfree(b);
+		return NULL;
+	}
+
+	b->b_wchan = wchan_create(b->b_name);
+	if (b->b_wchan == NULL) {
+		kfree(b->b_name);
+		kfree(b);
+		return NULL;
+	}
+
+	spinlock_init(&b->b_lock);
+	b->b_count = count;
+	b->b_arrived = 0;
+	return b;
+}
+
+void
+barrier_destroy(struct barrier *b)
+{
+	KASSERT(b != NULL);
+
+	/*
+	 * The last thread through may still be on its way out of
+	 * barrier_wait; wait for it to let go of the spinlock.
+	 */
+	spinlock_acquire(&b->b_lock);
+	KASSERT(b->b_arrived == 0);
+	spinlock_release(&b->b_lock);
+
+	/* wchan_destroy will assert if anyone's waiting */
+	spinlock_cleanup(&b->b_lock);
+	wchan_destroy(b->b_wchan);
+	kfree(b->b_name);
+	kfree(b);
+}
+
+bool
+barrier_wait(struct barrier *b)
+{
+	KASSERT(b != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&b->b_lock);
+	KASSERT(b->b_arrived < b->b_count);
+	b->b_arrived++;
+	if (b->b_arrived == b->b_count) {
+		/* Last one in; start the next round and let everyone go. */
+		b->b_arrived = 0;
+		wchan_wakeall(b->b_wchan);
+		spinlock_release(&b->b_lock);
+		return true;
+	}
+
+	/*
+	 * Only the last thread of the round wakes this channel, so
+	 * once we're woken the round is over and we can just go,
+	 * without looking at the barrier again.
+	 */
+	wchan_lock(b->b_wchan);
+	spinlock_release(&b->b_lock);
+	wchan_sleep(b->b_wchan);
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Completion.
+
+struct completion *
+completion_create(const char *name)
+{
+	struct completion *c;
+
+	c = kmalloc(sizeof(*c));
+	if (c == NULL) {
+		return NULL;
+	}
+
+	c->cm_name = kstrdup(name);
+	if (c->cm_name == NULL) {
+		kfree(c);
+		return NULL;
+	}
+
+	c->cm_wchan = wchan_create(c->cm_name);
+	if (c->cm_wchan == NULL) {
+		kfree(c->cm_name);
+		kfree(c);
+		return NULL;
+	}
+
+	spinlock_init(&c->cm_lock);
+	c->cm_done = 0;
+	c->cm_all = false;
+	return c;
+}
+
+void
+completion_destroy(struct completion *c)
+{
+	KASSERT(c != NULL);
+
+	/* As in barrier_destroy, let the last completer get out. */
+	spinlock_acquire(&c->cm_lock);
+	spinlock_release(&c->cm_lock);
+
+	/* wchan_destroy will assert if anyone's waiting */
+	spinlock_cleanup(&c->cm_lock);
+	wchan_destroy(c->cm_wchan);
+	kfree(c->cm_name);
+	kfree(c);
+}
+
+void
+completion_wait(struct completion *c)
+{
+	KASSERT(c != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&c->cm_lock);
+	if (c->cm_all) {
+		spinlock_release(&c->cm_lock);
+		return;
+	}
+	if (c->cm_done > 0) {
+		c->cm_done--;
+		spinlock_release(&c->cm_lock);
+		return;
+	}
+
+	/*
+	 * complete hands itself straight to a sleeper rather than
+	 * counting in cm_done, so there's nothing to take on waking.
+	 */
+	wchan_lock(c->cm_wchan);
+	spinlock_release(&c->cm_lock);
+	wchan_sleep(c->cm_wchan);
+}
+
+void
+complete(struct completion *c)
+{
+	KASSERT(c != NULL);
+
+	spinlock_acquire(&c->cm_lock);
+	if (!c->cm_all && wchan_wakehead(c->cm_wchan) == NULL) {
+		c->cm_done++;
+	}
+	spinlock_release(&c->cm_lock);
+}
+
+void
+complete_all(struct completion *c)
+{
+	KASSERT(c != NULL);
+
+	spinlock_acquire(&c->cm_lock);
+	c->cm_all = true;
+	wchan_wakeall(c->cm_wchan);
+	spinlock_release(&c->cm_lock);
+}
+
+void
+completion_reinit(struct completion *c)
+{
+	KASSERT(c != NULL);
+
+	spinlock_acquire(&c->cm_lock);
+	KASSERT(wchan_isempty(c->cm_wchan));
+	c->cm_done = 0;
+	c->cm_all = false;
+	spinlock_release(&c->cm_lock);
+}
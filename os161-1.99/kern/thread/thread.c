@@ -50,6 +50,9 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <kmem_cache.h>
+#include <rcu.h>
 
 #include "opt-synchprobs.h"
 
@@ -64,6 +67,23 @@ struct wchan {
 	struct spinlock wc_lock;	/* lock for mutual exclusion */
 };
 
+/*
+ * Object caches for threads and wait channels. Both are kept with
+ * their list structures initialized between uses.
+ */
+static int thread_ctor(void *obj);
+static void thread_dtor(void *obj);
+static void thread_init(struct thread *thread);
+static int wchan_ctor(void *obj);
+static void wchan_dtor(void *obj);
+
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread),
+			       thread_ctor, thread_dtor);
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan),
+			       wchan_ctor, wchan_dtor);
+
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -72,6 +92,10 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* List of all live threads, for thread_printtop. */
+static struct thread *allthreads;
+static struct spinlock allthreads_lock = SPINLOCK_INITIALIZER;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +135,93 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Set and free a thread's name. Short names go in t_namebuf, which
+ * saves a kstrdup on every fork.
+ */
+static
+int
+thread_setname(struct thread *thread, const char *name)
+{
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
+	}
+	thread->t_name = kstrdup(name);
+	if (thread->t_name == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = NULL;
+}
+
+/*
+ * Add a thread to, or remove it from, the list of all threads.
+ */
+static
+void
+thread_listall(struct thread *thread)
+{
+	spinlock_acquire(&allthreads_lock);
+	thread->t_allnext = allthreads;
+	if (allthreads != NULL) {
+		allthreads->t_allprevp = &thread->t_allnext;
+	}
+	thread->t_allprevp = &allthreads;
+	allthreads = thread;
+	spinlock_release(&allthreads_lock);
+}
+
+static
+void
+thread_unlistall(struct thread *thread)
+{
+	spinlock_acquire(&allthreads_lock);
+	*thread->t_allprevp = thread->t_allnext;
+	if (thread->t_allnext != NULL) {
+		thread->t_allnext->t_allprevp = thread->t_allprevp;
+	}
+	thread->t_allnext = NULL;
+	thread->t_allprevp = NULL;
+	spinlock_release(&allthreads_lock);
+}
+
+/*
+ * Thread cache constructor and destructor. The list node and the
+ * machine-dependent part don't change between uses, so set them up
+ * only when a thread structure is first made.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -123,35 +234,66 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
+	if (thread_setname(thread, name)) {
+		kmem_cache_free(&thread_cache, thread);
 		return NULL;
 	}
+	thread->t_stack = NULL;
+	thread_init(thread);
+
+	return thread;
+}
+
+/*
+ * Initialize the fields of a new thread, other than its name and
+ * stack. Used by thread_create and for threads from the pool.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* (t_machdep and t_listnode are set up by thread_ctor) */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
+
+	/* Scheduler fields; new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_affinity = (uint32_t)-1;
+	thread->t_strideawake = false;
+	thread->t_inherited = MLFQ_NLEVELS;
+	thread->t_blockedon = NULL;
+	thread->t_blockedlevel = 0;
+	thread->t_heldlocks = NULL;
+
+	/* Accounting */
+	bzero(&thread->t_stats, sizeof(thread->t_stats));
+	thread->t_statesince = 0;
+	thread->t_allnext = NULL;
+	thread->t_allprevp = NULL;
+
+	/* Sleep state */
+	thread->t_wchan = NULL;
+	thread->t_timedout = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	thread->t_rcudepth = 0;
 
 	/* If you add to struct thread, be sure to initialize here */
-
-	return thread;
 }
 
 /*
@@ -179,9 +321,16 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_leaving);
+	threadlist_init(&c->c_threadpool);
+	c->c_poolhits = 0;
 	c->c_hardclocks = 0;
+	c->c_stealseed = hardware_number + 1;
+	c->c_steals = 0;
+	c->c_switches = 0;
 
 	c->c_isidle = false;
+	c->c_rcugen = 0;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
@@ -221,6 +370,9 @@ cpu_create(unsigned hardware_number)
 		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
+	thread_listall(c->c_curthread);
+
+	timerwheel_create(c->c_number);
 
 	cpu_machdep_init(c);
 
@@ -252,21 +404,26 @@ thread_destroy(struct thread *thread)
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
-	thread_machdep_cleanup(&thread->t_machdep);
+	/* Back to the state thread_ctor left it in. */
+	KASSERT(thread->t_listnode.tln_next == NULL);
+	KASSERT(thread->t_listnode.tln_prev == NULL);
+	KASSERT(thread->t_machdep.tm_badfaultfunc == NULL);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
-	kfree(thread);
+	thread_freename(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu. So is the pool of reaped threads
+ * that thread_fork reuses: as long as there's room, zombies go there
+ * still attached to their stacks instead of being destroyed, so
+ * fork/exit churn doesn't go through kmalloc at all.
  */
 static
 void
@@ -277,8 +434,52 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (z->t_stack != NULL &&
+		    curcpu->c_threadpool.tl_count < THREAD_POOLSIZE) {
+			/* Same checks as thread_destroy */
+			KASSERT(z->t_proc == NULL);
+			KASSERT(z->t_machdep.tm_badfaultfunc == NULL);
+			thread_checkstack(z);
+			thread_freename(z);
+			z->t_wchan_name = "POOLED";
+			threadlist_addhead(&curcpu->c_threadpool, z);
+		}
+		else {
+			thread_destroy(z);
+		}
+	}
+}
+
+/*
+ * Get a thread from the current cpu's pool, if there is one. It
+ * comes with a stack, whose guard band is still intact.
+ */
+static
+struct thread *
+thread_pool_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	/* Keep interrupts (and exorcise) off the pool */
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadpool);
+	if (thread != NULL) {
+		curcpu->c_poolhits++;
+	}
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
 	}
+	KASSERT(thread->t_stack != NULL);
+
+	if (thread_setname(thread, name)) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_init(thread);
+	return thread;
 }
 
 /*
@@ -426,6 +627,322 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a cpu's run queue. The queue is kept sorted by
+ * priority level, and is FIFO within each level. Most threads go at
+ * or near the end, so search backwards.
+ */
+static
+void
+thread_enqueue(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	/* (The bookends have null tln_self, so stop at the head.) */
+	for (tln = c->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (THREAD_PRIORITY(tln->tln_self) <= THREAD_PRIORITY(t)) {
+			threadlist_insertafter(&c->c_runqueue,
+					       tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/* True if thread T is allowed to run on cpu C. */
+#define THREAD_CPU_OK(t, c) \
+	(((t)->t_affinity & ((uint32_t)1 << (c)->c_number)) != 0)
+
+/* A cpu with at most this many threads waiting counts as lightly loaded. */
+#define THREAD_LIGHTLOAD  1
+
+/*
+ * Choose a cpu for thread T, which is about to be put on a run queue.
+ *
+ * The cpu it last ran on is preferred if it's allowed and is idle or
+ * lightly loaded, because some of the thread's working set may still
+ * be in that cpu's cache. Otherwise, take the first idle cpu we're
+ * allowed on, looking at the last cpu's neighbours first; failing
+ * that, stay put if possible, or take the first allowed cpu.
+ *
+ * Loads are read without locking; this is only a placement heuristic.
+ */
+static
+struct cpu *
+thread_choose_cpu(struct thread *t)
+{
+	struct cpu *last, *c, *fallback;
+	unsigned i, numcpus;
+
+	last = t->t_cpu;
+	if (THREAD_CPU_OK(t, last) &&
+	    (last->c_isidle ||
+	     last->c_runqueue.tl_count <= THREAD_LIGHTLOAD)) {
+		return last;
+	}
+
+	fallback = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (last->c_number + i) % numcpus);
+		if (!THREAD_CPU_OK(t, c)) {
+			continue;
+		}
+		if (c->c_isidle) {
+			return c;
+		}
+		if (fallback == NULL) {
+			fallback = c;
+		}
+	}
+
+	if (THREAD_CPU_OK(t, last)) {
+		return last;
+	}
+	/* thread_setaffinity makes sure some cpu is allowed */
+	KASSERT(fallback != NULL);
+	return fallback;
+}
+
+/*
+ * Work stealing.
+ *
+ * This is called from the idle loop in thread_switch when the current
+ * cpu has nothing to run. It picks the busy peer with the most threads
+ * waiting and takes one from the tail of that cpu's run queue, which
+ * is the lowest-priority thread and the one that has waited least.
+ * The scan starts from a random cpu so that idle cpus don't all pile
+ * onto the same victim when the counts are tied.
+ *
+ * The counts are read without locking; they're only a hint. We never
+ * hold two run queue locks at once, so two cpus stealing from each
+ * other can't deadlock.
+ *
+ * Returns true if a thread was moved onto our run queue.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *self, *c, *victim;
+	struct threadlistnode *tln;
+	struct thread *t;
+	unsigned i, start, numcpus, count, best;
+
+	self = curcpu->c_self;
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 2) {
+		return false;
+	}
+
+	self->c_stealseed = self->c_stealseed * 1103515245 + 12345;
+	start = (self->c_stealseed >> 16) % numcpus;
+
+	victim = NULL;
+	best = 0;
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (start + i) % numcpus);
+		if (c == self || c->c_isidle) {
+			/* Idle cpus will run their own threads shortly. */
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > best) {
+			victim = c;
+			best = count;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	t = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (tln = victim->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		/*
+		 * The victim's curthread can be on its run queue; see
+		 * thread_consider_migration. Leave it alone. Also
+		 * skip threads that aren't allowed to run here.
+		 */
+		if (tln->tln_self != victim->c_curthread &&
+		    THREAD_CPU_OK(tln->tln_self, self)) {
+			t = tln->tln_self;
+			threadlist_remove(&victim->c_runqueue, t);
+			break;
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&self->c_runqueue_lock);
+	t->t_cpu = self;
+	t->t_stats.ss_migrations++;
+	thread_enqueue(self, t);
+	self->c_steals++;
+	spinlock_release(&self->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, self->c_number);
+	return true;
+}
+
+/*
+ * Stride scheduling state; see the comments with schedule(). The lock
+ * covers the stride fields of every process and thread, plus these.
+ *
+ * stride_vtime is the global virtual time: each tick charged to
+ * anyone advances it by the stride a process would have if it held
+ * every ticket of the processes that are awake (stride_tickets), so
+ * it moves at the ticket-weighted average rate of their passes.
+ *
+ * Passes are 64 bits and never wrap in practice (a one-ticket process
+ * would need thousands of years of cpu), so they're compared directly.
+ */
+static struct spinlock stride_lock = SPINLOCK_INITIALIZER;
+static uint64_t stride_vtime;
+static unsigned stride_tickets;
+
+/*
+ * Thread T is waking up, or is new. If no other thread of its process
+ * is awake, the process rejoins: its tickets count toward
+ * stride_tickets again, and since it has fallen behind in virtual
+ * time while it was away, its pass is brought up to stride_vtime so
+ * it doesn't monopolize the cpu to catch up. If some other thread is
+ * awake, the process has been charged all along, so leave its pass
+ * alone.
+ *
+ * (Threads that were never counted, like the boot thread, are simply
+ * counted from their first wakeup on.)
+ */
+static
+void
+stride_rejoin(struct thread *t)
+{
+	struct proc *p = t->t_proc;
+
+	if (p == NULL) {
+		return;
+	}
+	spinlock_acquire(&stride_lock);
+	if (!t->t_strideawake) {
+		t->t_strideawake = true;
+		if (p->p_nawake++ == 0) {
+			stride_tickets += p->p_tickets;
+			if (p->p_pass < stride_vtime) {
+				p->p_pass = stride_vtime;
+			}
+		}
+	}
+	spinlock_release(&stride_lock);
+}
+
+/*
+ * Thread T is going to sleep or leaving its process. If it was the
+ * last one awake, the process stops counting toward stride_tickets.
+ */
+void
+thread_stride_leave(struct thread *t)
+{
+	struct proc *p = t->t_proc;
+
+	if (p == NULL) {
+		return;
+	}
+	spinlock_acquire(&stride_lock);
+	if (t->t_strideawake) {
+		t->t_strideawake = false;
+		KASSERT(p->p_nawake > 0);
+		if (--p->p_nawake == 0) {
+			KASSERT(stride_tickets >= p->p_tickets);
+			stride_tickets -= p->p_tickets;
+		}
+	}
+	spinlock_release(&stride_lock);
+}
+
+/*
+ * Charge process P for one tick. This is called from every cpu, so
+ * a process's pass reflects the time used by all its threads.
+ */
+static
+void
+stride_charge(struct proc *p)
+{
+	if (p == NULL) {
+		/* exiting thread that has already left its process */
+		return;
+	}
+	spinlock_acquire(&stride_lock);
+	p->p_pass += p->p_stride;
+	if (stride_tickets > 0) {
+		stride_vtime += PROC_STRIDE1 / stride_tickets;
+	}
+	spinlock_release(&stride_lock);
+}
+
+/*
+ * Take the next thread to run off a cpu's run queue: of the threads
+ * on the best priority level, the one whose process has the lowest
+ * pass. Ties go to the thread that has waited longest. The passes
+ * are read without the stride lock; a stale (or, being 64 bits, torn)
+ * value only costs a little accuracy.
+ */
+static
+struct thread *
+thread_pick_next(struct cpu *c)
+{
+	struct threadlistnode *tln;
+	struct thread *t, *best;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (threadlist_isempty(&c->c_runqueue)) {
+		return NULL;
+	}
+
+	best = c->c_runqueue.tl_head.tln_next->tln_self;
+	for (tln = best->t_listnode.tln_next;
+	     tln->tln_next != NULL &&
+		     THREAD_PRIORITY(tln->tln_self) == THREAD_PRIORITY(best);
+	     tln = tln->tln_next) {
+		t = tln->tln_self;
+		if (best->t_proc == NULL) {
+			/* exiting; let it finish */
+			break;
+		}
+		if (t->t_proc == NULL ||
+		    t->t_proc->p_pass < best->t_proc->p_pass) {
+			best = t;
+		}
+	}
+
+	threadlist_remove(&c->c_runqueue, best);
+	return best;
+}
+
+/*
+ * A thread is going onto a run queue at time NOW. If it was asleep,
+ * account for the time asleep; start its ready-queue clock.
+ */
+static
+void
+thread_readyclock(struct thread *target, uint64_t now)
+{
+	if (target->t_state == S_SLEEP && target->t_statesince != 0) {
+		target->t_stats.ss_sleeptime += now - target->t_statesince;
+	}
+	target->t_statesince = now;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -435,7 +952,8 @@ static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
-	struct cpu *targetcpu;
+	struct cpu *targetcpu, *newcpu;
+	uint64_t now;
 	bool isidle;
 
 	/* Lock the run queue of the target thread's cpu. */
@@ -449,8 +967,33 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	/*
+	 * If the thread is waking up, consider putting it somewhere
+	 * else. But if its old cpu went idle right after it went to
+	 * sleep, that cpu is still running on the thread's stack and
+	 * the thread must stay there. (c_curthread only changes under
+	 * the run queue lock, which we hold.)
+	 */
+	if (!already_have_lock) {
+		/* Waking up or new; catch up with virtual time. */
+		stride_rejoin(target);
+	}
+	now = clock_nsecs();
+	thread_readyclock(target, now);
+
+	if (!already_have_lock && target->t_state == S_SLEEP) {
+		newcpu = thread_choose_cpu(target);
+		if (newcpu != targetcpu && target != targetcpu->c_curthread) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			target->t_cpu = newcpu;
+			target->t_stats.ss_migrations++;
+			targetcpu = newcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
+	}
+
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -487,18 +1030,22 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Reuse a thread and stack if we have one handy */
+	newthread = thread_pool_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -506,6 +1053,10 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	if (!THREAD_CPU_OK(newthread, newthread->t_cpu)) {
+		newthread->t_cpu = thread_choose_cpu(newthread);
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -528,6 +1079,8 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	thread_listall(newthread);
+
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
@@ -535,23 +1088,67 @@ thread_fork(const char *name,
 }
 
 /*
- * High level, machine-independent context switch code.
- *
- * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
- *
- * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
- * WC. Otherwise WC should be NULL.
+ * Send threads that yielded on a cpu their affinity no longer allows
+ * (see thread_switch) to one that it does. They couldn't go onto
+ * another cpu's run queue while this cpu was still running on their
+ * stacks; now that we've switched away, they can. Called after every
+ * switch, like exorcise.
  */
 static
 void
-thread_switch(threadstate_t newstate, struct wchan *wc)
+thread_sendaway(void)
 {
-	struct thread *cur, *next;
-	int spl;
+	struct threadlist leaving;
+	struct thread *t;
+	struct cpu *c;
 
-	DEBUGASSERT(curcpu->c_curthread == curthread);
-	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+	if (threadlist_isempty(&curcpu->c_leaving)) {
+		return;
+	}
+
+	threadlist_init(&leaving);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&curcpu->c_leaving)) != NULL) {
+		KASSERT(t != curthread);
+		threadlist_addtail(&leaving, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&leaving)) != NULL) {
+		c = thread_choose_cpu(t);
+		spinlock_acquire(&c->c_runqueue_lock);
+		t->t_cpu = c;
+		t->t_stats.ss_migrations++;
+		thread_readyclock(t, clock_nsecs());
+		thread_enqueue(c, t);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	threadlist_cleanup(&leaving);
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
+ * to NEWSTATE; another thread to run is selected and switched to.
+ *
+ * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
+ * WC. Otherwise WC should be NULL.
+ */
+static
+void
+thread_switch(threadstate_t newstate, struct wchan *wc)
+{
+	struct thread *cur, *next;
+	uint64_t now;
+	int spl;
+
+	DEBUGASSERT(curcpu->c_curthread == curthread);
+	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+	KASSERT(curthread->t_rcudepth == 0);
 
 	/* Explicitly disable interrupts on this processor */
 	spl = splhigh();
@@ -573,6 +1170,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/* Not in an rcu read section, so any old versions are done with */
+	curcpu->c_rcugen = rcu_gen;
+
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
@@ -585,10 +1185,31 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		cur->t_stats.ss_nivcsw++;
+		if (!THREAD_CPU_OK(cur, curcpu)) {
+			/*
+			 * Not allowed here any more. The run queue isn't
+			 * empty (see above), so some other thread runs
+			 * next, and it sends us away; see thread_sendaway.
+			 */
+			threadlist_addtail(&curcpu->c_leaving, cur);
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_stats.ss_nvcsw++;
+		cur->t_statesince = clock_nsecs();
+		thread_stride_leave(cur);
+		/*
+		 * Blocking before the quantum is used up earns a
+		 * move up one level.
+		 */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_ticks = 0;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -603,6 +1224,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * without racing. Exercise: what's the other?)
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_wchan = wc;
 		wchan_unlock(wc);
 		break;
 	    case S_ZOMBIE:
@@ -613,7 +1235,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from another cpu, and failing that call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -632,15 +1255,25 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = thread_pick_next(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				clock_idle_enter();
+				cpu_idle();
+				clock_idle_exit();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Charge the next thread for its time on the run queue. */
+	now = clock_nsecs();
+	if (next->t_statesince != 0 && now > next->t_statesince) {
+		next->t_stats.ss_readywait += now - next->t_statesince;
+	}
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -650,6 +1283,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 */
 	curcpu->c_curthread = next;
 	curthread = next;
+	if (next != cur) {
+		curcpu->c_switches++;
+	}
 
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
@@ -714,6 +1350,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Move threads that can't stay on this cpu. */
+	thread_sendaway();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -747,6 +1386,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Move threads that can't stay on this cpu. */
+	thread_sendaway();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -799,6 +1441,8 @@ thread_exit(void)
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
 
+	thread_unlistall(cur);
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
@@ -822,17 +1466,100 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * There are two parts: priority levels to favor interactive threads,
+ * and stride scheduling to divide the cpu fairly between processes.
+ *
+ * The first part is a multi-level feedback queue. Each thread has a
+ * priority level, and each cpu's run queue is kept sorted by level
+ * (see thread_enqueue), so the head of the queue is always on the
+ * best level waiting. Each level has a quantum, measured in hardclocks; a
+ * thread that uses up its whole quantum drops one level, and a thread
+ * that blocks before then moves up one (see thread_switch). The low
+ * levels get longer quanta, so CPU-bound threads switch less often
+ * while interactive threads stay near the top and run promptly when
+ * they wake up.
+ *
+ * To keep CPU-bound threads from starving when there are enough
+ * interactive ones to keep the top levels busy, every so often all
+ * threads on the cpu are put back on the top level.
+ *
+ * Among threads on the same level, processes share the cpu in
+ * proportion to their tickets. Each process has a stride, inversely
+ * proportional to its tickets, and a pass, which advances by the
+ * stride every tick any of its threads runs on any cpu. The next
+ * thread to run is the one whose process has the lowest pass (see
+ * thread_pick_next), so a process with ten threads gets no more than
+ * one with a single thread and the same tickets.
+ *
+ * schedule() is called from hardclock() on every tick. It charges
+ * the tick to the current thread and its process, and yields if
+ * either the quantum has run out or a thread with higher priority is
+ * waiting.
  */
 
+#define MLFQ_BOOST_HARDCLOCKS	HZ	/* Boost everyone once a second */
+
+/* Quantum for each level, in hardclocks. */
+static const unsigned mlfq_quantum[MLFQ_NLEVELS] = { 1, 2, 4, 8 };
+
 void
 schedule(void)
 {
+	struct threadlistnode *tln;
+	struct thread *cur, *t;
+	bool preempt;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If we're idle, curthread is some thread that went to sleep;
+	 * don't charge it for the idle time.
 	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	preempt = false;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	/* Interrupts were on, so we weren't in an rcu read section. */
+	curcpu->c_rcugen = rcu_gen;
+
+	if ((curcpu->c_hardclocks % MLFQ_BOOST_HARDCLOCKS) == 0) {
+		/* Setting everything to the same level keeps the order. */
+		for (tln = curcpu->c_runqueue.tl_head.tln_next;
+		     tln->tln_next != NULL;
+		     tln = tln->tln_next) {
+			tln->tln_self->t_priority = 0;
+			tln->tln_self->t_ticks = 0;
+		}
+		cur->t_priority = 0;
+		cur->t_ticks = 0;
+	}
+
+	stride_charge(cur->t_proc);
+
+	KASSERT(cur->t_priority < MLFQ_NLEVELS);
+	cur->t_ticks++;
+	if (cur->t_ticks >= mlfq_quantum[cur->t_priority]) {
+		if (cur->t_priority < MLFQ_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		preempt = true;
+	}
+	else if (!threadlist_isempty(&curcpu->c_runqueue)) {
+		t = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		if (THREAD_PRIORITY(t) < THREAD_PRIORITY(cur)) {
+			preempt = true;
+		}
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
 }
 
 /*
@@ -859,8 +1586,38 @@ thread_consider_migration(void)
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
+	struct threadlistnode *tln, *nexttln;
 	struct thread *t;
 
+	/*
+	 * First, send away any threads that aren't allowed to run
+	 * here. (See below about curthread.)
+	 */
+	threadlist_init(&victims);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (tln = curcpu->c_runqueue.tl_head.tln_next;
+	     tln->tln_next != NULL;
+	     tln = nexttln) {
+		nexttln = tln->tln_next;
+		t = tln->tln_self;
+		if (!THREAD_CPU_OK(t, curcpu) && t != curthread) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addtail(&victims, t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&victims)) != NULL) {
+		c = thread_choose_cpu(t);
+		spinlock_acquire(&c->c_runqueue_lock);
+		t->t_cpu = c;
+		t->t_stats.ss_migrations++;
+		thread_enqueue(c, t);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
@@ -879,7 +1636,6 @@ thread_consider_migration(void)
 	}
 
 	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
 		t = threadlist_remtail(&curcpu->c_runqueue);
@@ -922,9 +1678,16 @@ thread_consider_migration(void)
 				to_send--;
 				continue;
 			}
+			/* Likewise threads that can't run there. */
+			if (!THREAD_CPU_OK(t, c)) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_stats.ss_migrations++;
+			thread_enqueue(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1711,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_enqueue(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -957,6 +1720,304 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * CPU affinity.
+ */
+
+/*
+ * Something for this cpu to run while thread_setaffinity's caller
+ * gets off it.
+ */
+static
+void
+thread_affinity_stub(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+}
+
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
+	int result;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32) {
+		if ((mask & (((uint32_t)1 << numcpus) - 1)) == 0) {
+			return EINVAL;
+		}
+	}
+	else if (mask == 0) {
+		return EINVAL;
+	}
+
+	/*
+	 * If we're not allowed here any more, yield so thread_switch
+	 * sends us somewhere we are. That only works if this cpu has
+	 * something else to run, so first give it a stub thread that
+	 * may run only here. (Another cpu might steal the stub before
+	 * we yield; then we just try again.) If we can't fork, we'll
+	 * move the next time we sleep instead.
+	 *
+	 * Only the thread itself changes t_affinity; no lock needed.
+	 */
+	while ((mask & ((uint32_t)1 << curcpu->c_number)) == 0) {
+		curthread->t_affinity = (uint32_t)1 << curcpu->c_number;
+		result = thread_fork("affinity", kproc,
+				     thread_affinity_stub, NULL, 0);
+		curthread->t_affinity = mask;
+		if (result) {
+			return 0;
+		}
+		thread_yield();
+	}
+	curthread->t_affinity = mask;
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
+/*
+ * Tickets for stride scheduling.
+ */
+int
+thread_settickets(unsigned tickets)
+{
+	struct proc *p = curthread->t_proc;
+
+	if (tickets < 1 || tickets > PROC_MAXTICKETS) {
+		return EINVAL;
+	}
+	KASSERT(p != NULL);
+
+	spinlock_acquire(&stride_lock);
+	if (p->p_nawake > 0) {
+		/* We're awake, so our tickets are in stride_tickets */
+		stride_tickets = stride_tickets - p->p_tickets + tickets;
+	}
+	p->p_tickets = tickets;
+	p->p_stride = PROC_STRIDE1 / tickets;
+	spinlock_release(&stride_lock);
+	return 0;
+}
+
+/*
+ * Lend thread T a priority level (or take it back). The run queues
+ * are sorted by effective priority, so if T is waiting on one, it has
+ * to be moved. A thread that is running, asleep, or between queues
+ * just gets the new level, which takes effect when it's next queued.
+ * T can move to another cpu while we look; if so, go after it.
+ */
+void
+thread_inherit(struct thread *t, unsigned level)
+{
+	struct threadlistnode *tln;
+	struct cpu *c;
+	bool queued;
+
+	KASSERT(level <= MLFQ_NLEVELS);
+
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		t->t_inherited = level;
+		queued = false;
+		for (tln = c->c_runqueue.tl_head.tln_next;
+		     tln->tln_next != NULL;
+		     tln = tln->tln_next) {
+			if (tln->tln_self == t) {
+				queued = true;
+				break;
+			}
+		}
+		if (queued) {
+			threadlist_remove(&c->c_runqueue, t);
+			thread_enqueue(c, t);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+		if (queued || t->t_cpu == c) {
+			break;
+		}
+	}
+}
+
+/*
+ * Number of cpus.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Total context switches. Like cpu_printstats, this doesn't lock.
+ */
+unsigned
+cpu_switchcount(void)
+{
+	unsigned i, total = 0;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		total += cpuarray_get(&allcpus, i)->c_switches;
+	}
+	return total;
+}
+
+/*
+ * An idle cpu can't be in an rcu read section, and neither can this
+ * one, since we aren't in one and they don't sleep. Interrupts stay
+ * off so we don't move while checking.
+ */
+unsigned
+cpu_rcuseen(unsigned gen)
+{
+	unsigned i, seen;
+	struct cpu *c;
+	int spl;
+
+	seen = gen;
+	spl = splhigh();
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (!c->c_isidle && (int)(c->c_rcugen - seen) < 0) {
+			seen = c->c_rcugen;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	splx(spl);
+	return seen;
+}
+
+/*
+ * Print per-cpu scheduling statistics. The numbers are read without
+ * locking, so they're only approximate.
+ */
+void
+cpu_printstats(void)
+{
+	unsigned i;
+	struct cpu *c;
+
+	kprintf("%4s %10s %6s %6s %8s %5s %9s %9s\n", "cpu", "hardclocks",
+		"ready", "idle", "steals", "pool", "poolhits", "switches");
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%4u %10u %6u %6s %8u %5u %9u %9u\n", c->c_number,
+			c->c_hardclocks, c->c_runqueue.tl_count,
+			c->c_isidle ? "yes" : "no", c->c_steals,
+			c->c_threadpool.tl_count, c->c_poolhits,
+			c->c_switches);
+	}
+}
+
+/*
+ * Scheduling statistics.
+ */
+void
+schedstats_add(struct schedstats *to, const struct schedstats *from)
+{
+	to->ss_runticks += from->ss_runticks;
+	to->ss_readywait += from->ss_readywait;
+	to->ss_sleeptime += from->ss_sleeptime;
+	to->ss_nvcsw += from->ss_nvcsw;
+	to->ss_nivcsw += from->ss_nivcsw;
+	to->ss_migrations += from->ss_migrations;
+}
+
+/*
+ * One row of thread_printtop's table, copied out of the thread so
+ * it can be printed without holding allthreads_lock.
+ */
+struct topentry {
+	char te_name[THREAD_NAMELEN];
+	unsigned te_cpu;
+	threadstate_t te_state;
+	unsigned te_priority;
+	struct schedstats te_stats;
+};
+
+/*
+ * Print a top-like table of threads, busiest (most run ticks) first.
+ * Like cpu_printstats, this reads other cpus' numbers unlocked.
+ */
+void
+thread_printtop(unsigned max)
+{
+	static const char *const statenames[] = {
+		"run", "ready", "sleep", "zombie"
+	};
+	struct topentry *tab, tmp;
+	struct thread *t;
+	unsigned i, j, n, space;
+
+	/* Count, then allocate with some room for new arrivals. */
+	spinlock_acquire(&allthreads_lock);
+	space = 0;
+	for (t = allthreads; t != NULL; t = t->t_allnext) {
+		space++;
+	}
+	spinlock_release(&allthreads_lock);
+	space += 8;
+
+	tab = kmalloc(space * sizeof(*tab));
+	if (tab == NULL) {
+		kprintf("top: Out of memory\n");
+		return;
+	}
+
+	spinlock_acquire(&allthreads_lock);
+	n = 0;
+	for (t = allthreads; t != NULL && n < space; t = t->t_allnext) {
+		snprintf(tab[n].te_name, sizeof(tab[n].te_name), "%s",
+			 t->t_name);
+		tab[n].te_cpu = t->t_cpu->c_number;
+		tab[n].te_state = t->t_state;
+		tab[n].te_priority = THREAD_PRIORITY(t);
+		tab[n].te_stats = t->t_stats;
+		n++;
+	}
+	spinlock_release(&allthreads_lock);
+
+	/* Insertion sort by run ticks, largest first. */
+	for (i=1; i<n; i++) {
+		tmp = tab[i];
+		for (j=i; j>0 && tab[j-1].te_stats.ss_runticks <
+			     tmp.te_stats.ss_runticks; j--) {
+			tab[j] = tab[j-1];
+		}
+		tab[j] = tmp;
+	}
+
+	kprintf("%-15s %3s %6s %3s %8s %9s %9s %7s %7s %5s\n",
+		"thread", "cpu", "state", "pri", "runticks", "readyms",
+		"sleepms", "vcsw", "ivcsw", "migr");
+	for (i=0; i<n && i<max; i++) {
+		kprintf("%-15s %3u %6s %3u %8u %9u %9u %7u %7u %5u\n",
+			tab[i].te_name, tab[i].te_cpu,
+			statenames[tab[i].te_state], tab[i].te_priority,
+			tab[i].te_stats.ss_runticks,
+			(unsigned)(tab[i].te_stats.ss_readywait / 1000000),
+			(unsigned)(tab[i].te_stats.ss_sleeptime / 1000000),
+			tab[i].te_stats.ss_nvcsw, tab[i].te_stats.ss_nivcsw,
+			tab[i].te_stats.ss_migrations);
+	}
+	if (n > max) {
+		kprintf("(%u more)\n", n - max);
+	}
+
+	kfree(tab);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -976,12 +2037,10 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	spinlock_init(&wc->wc_lock);
-	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 	return wc;
 }
@@ -993,9 +2052,34 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
+	KASSERT(!spinlock_do_i_hold(&wc->wc_lock));
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_name = "DESTROYED";
+	kmem_cache_free(&wchan_cache, wc);
+}
+
+/*
+ * Wait channel cache constructor and destructor.
+ */
+static
+int
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	spinlock_init(&wc->wc_lock);
+	threadlist_init(&wc->wc_threads);
+	return 0;
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
 }
 
 /*
@@ -1028,17 +2112,95 @@ wchan_sleep(struct wchan *wc)
 	thread_switch(S_SLEEP, wc);
 }
 
+/*
+ * Timeout handling for wchan_sleep_timeout. The timer function runs
+ * from the timer interrupt; if the thread is still on the channel,
+ * it takes it off and wakes it.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+};
+
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+	struct wchan *wc = wt->wt_wchan;
+
+	spinlock_acquire(&wc->wc_lock);
+	if (target->t_wchan != wc) {
+		/* Already woken up the normal way. */
+		spinlock_release(&wc->wc_lock);
+		return;
+	}
+	threadlist_remove(&wc->wc_threads, target);
+	target->t_wchan = NULL;
+	target->t_timedout = true;
+	spinlock_release(&wc->wc_lock);
+
+	thread_make_runnable(target, false);
+}
+
+/*
+ * Like wchan_sleep, but give up after NSECS nanoseconds. Returns 0
+ * if woken by wchan_wake*, or ETIMEDOUT.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, uint64_t nsecs)
+{
+	struct wchan_timeout wt;
+	struct timer tm;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	curthread->t_timedout = false;
+
+	/*
+	 * The timer function takes the channel lock, so it can't see
+	 * us before we're on the channel's list.
+	 */
+	timer_init(&tm, wchan_timeout, &wt);
+	timer_start(&tm, nsecs);
+
+	thread_switch(S_SLEEP, wc);
+
+	/* If we were woken normally, the timer may still be pending. */
+	timer_cancel(&tm);
+
+	return curthread->t_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
 void
 wchan_wakeone(struct wchan *wc)
+{
+	(void)wchan_wakehead(wc);
+}
+
+/*
+ * Wake up the thread at the head of the wait channel's queue, which
+ * is the one that has waited longest, and return it.
+ */
+struct thread *
+wchan_wakehead(struct wchan *wc)
 {
 	struct thread *target;
 
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
 	target = threadlist_remhead(&wc->wc_threads);
+	if (target != NULL) {
+		target->t_wchan = NULL;
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1047,22 +2209,59 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	thread_make_runnable(target, false);
+	return target;
+}
+
+/*
+ * Move the threads on FROM whose t_cpu is C to TO. The lists are
+ * private to the caller, so no locking is needed.
+ */
+static
+void
+wchan_takecpu(struct threadlist *from, struct cpu *c, struct threadlist *to)
+{
+	struct threadlistnode *tln, *next;
+	struct thread *t;
+
+	/* (The bookends have null tln_self.) */
+	for (tln = from->tl_head.tln_next; tln->tln_self != NULL; tln = next) {
+		next = tln->tln_next;
+		t = tln->tln_self;
+		if (t->t_cpu == c) {
+			threadlist_remove(from, t);
+			threadlist_addtail(to, t);
+		}
+	}
 }
 
 /*
  * Wake up all threads sleeping on a wait channel.
+ *
+ * Rather than make each thread runnable separately, which costs a
+ * run queue lock round trip and possibly an IPI per thread, handle
+ * the threads a cpu at a time. First, under the run queue lock of the
+ * cpu each thread last ran on, do the wakeup bookkeeping and choose
+ * where it should run; threads that stay are queued right there.
+ * Then queue the ones that are moving, again a cpu at a time. An idle
+ * cpu is sent at most one IPI no matter how many threads it gets.
  */
 void
 wchan_wakeall(struct wchan *wc)
 {
 	struct thread *target;
-	struct threadlist list;
+	struct threadlist list, batch, moving;
+	struct cpu *c, *newcpu;
+	uint32_t kicked;
+	uint64_t now;
+	bool queued;
 
 	threadlist_init(&list);
+	threadlist_init(&batch);
+	threadlist_init(&moving);
 
 	/*
 	 * Lock the channel and grab all the threads, moving them to a
@@ -1070,6 +2269,7 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_acquire(&wc->wc_lock);
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 	/*
@@ -1078,18 +2278,99 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_release(&wc->wc_lock);
 
-	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
-	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+	if (threadlist_isempty(&list)) {
+		/* Nobody was sleeping. */
+		threadlist_cleanup(&moving);
+		threadlist_cleanup(&batch);
+		threadlist_cleanup(&list);
+		return;
+	}
+
+	/* cpus we've sent IPI_UNIDLE; one bit each, as in t_affinity */
+	kicked = 0;
+	now = clock_nsecs();
+
+	/* Pass 1: by the cpu each thread last ran on. */
+	while (!threadlist_isempty(&list)) {
+		c = list.tl_head.tln_next->tln_self->t_cpu;
+		wchan_takecpu(&list, c, &batch);
+
+		queued = false;
+		spinlock_acquire(&c->c_runqueue_lock);
+		while ((target = threadlist_remhead(&batch)) != NULL) {
+			/* As in thread_make_runnable */
+			stride_rejoin(target);
+			thread_readyclock(target, now);
+			newcpu = thread_choose_cpu(target);
+			if (newcpu != c && target != c->c_curthread) {
+				target->t_cpu = newcpu;
+				target->t_stats.ss_migrations++;
+				threadlist_addtail(&moving, target);
+				continue;
+			}
+			thread_enqueue(c, target);
+			queued = true;
+		}
+		if (queued && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			kicked |= (uint32_t)1 << c->c_number;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	/* Pass 2: the ones that are moving, by their new cpu. */
+	while (!threadlist_isempty(&moving)) {
+		c = moving.tl_head.tln_next->tln_self->t_cpu;
+		wchan_takecpu(&moving, c, &batch);
+
+		spinlock_acquire(&c->c_runqueue_lock);
+		while ((target = threadlist_remhead(&batch)) != NULL) {
+			thread_enqueue(c, target);
+		}
+		if (c->c_isidle &&
+		    (kicked & ((uint32_t)1 << c->c_number)) == 0) {
+			ipi_send(c, IPI_UNIDLE);
+			kicked |= (uint32_t)1 << c->c_number;
+		}
+		spinlock_release(&c->c_runqueue_lock);
 	}
 
+	threadlist_cleanup(&moving);
+	threadlist_cleanup(&batch);
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move threads from one wait channel to another. Nothing gets
+ * woken, so the threads stay in S_SLEEP and stay off the run queues.
+ * A wchan_timeout for a moved thread finds it no longer on its old
+ * channel and leaves it alone, so it's treated as woken normally.
+ */
+unsigned
+wchan_requeue(struct wchan *from, struct wchan *to, bool all)
+{
+	struct thread *target;
+	unsigned n = 0;
+
+	KASSERT(from != to);
+
+	spinlock_acquire(&from->wc_lock);
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		KASSERT(target->t_wchan == from);
+		target->t_wchan = to;
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		n++;
+		if (!all) {
+			break;
+		}
+	}
+	spinlock_release(&to->wc_lock);
+	spinlock_release(&from->wc_lock);
+	return n;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
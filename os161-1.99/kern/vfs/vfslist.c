@@ -87,6 +87,14 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Lock for knowndevs and the kd_fs fields. Lookups take it for
+ * reading. Adding a device or changing kd_fs takes it for writing,
+ * and also holds vfs_biglock, so code that holds vfs_biglock can
+ * also read the list without it. Ordered after vfs_biglock.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -102,6 +110,10 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -155,6 +167,7 @@ vfs_sync(void)
 	unsigned i, num;
 
 	vfs_biglock_acquire();
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -164,6 +177,7 @@ vfs_sync(void)
 		}
 	}
 
+	rwlock_release_read(knowndevs_lock);
 	vfs_biglock_release();
 
 	return 0;
@@ -178,9 +192,17 @@ vfs_getroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
+	int err;
 
+	/* The FSOP and VOP calls below expect vfs_biglock. */
 	KASSERT(vfs_biglock_do_i_hold());
 
+	/*
+	 * If we don't find the device, it doesn't exist.
+	 */
+	err = ENODEV;
+
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -201,13 +223,15 @@ vfs_getroot(const char *devname, struct vnode **result)
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
 				*result = FSOP_GETROOT(kd->kd_fs);
-				return 0;
+				err = 0;
+				break;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
+				err = ENXIO;
+				break;
 			}
 		}
 
@@ -222,7 +246,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
-			return 0;
+			err = 0;
+			break;
 		}
 
 		/*
@@ -233,7 +258,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
-			return 0;
+			err = 0;
+			break;
 		}
 
 		/*
@@ -243,11 +269,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 		 */
 	}
 
-	/*
-	 * If we got here, the device specified by devname doesn't exist.
-	 */
-
-	return ENODEV;
+	rwlock_release_read(knowndevs_lock);
+	return err;
 }
 
 /*
@@ -259,10 +282,12 @@ vfs_getdevname(struct fs *fs)
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(fs != NULL);
+	const char *name;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(fs != NULL);
 
+	name = NULL;
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -274,11 +299,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -339,6 +366,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	struct knowndev *kd;
 
 	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -411,7 +439,10 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
+
 	if (badnames(name, rawname, volname)) {
+		rwlock_release_write(knowndevs_lock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
@@ -423,6 +454,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev->d_devnumber = index+1;
 	}
 
+	rwlock_release_write(knowndevs_lock);
 	vfs_biglock_release();
 	return result;
 
@@ -470,7 +502,8 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Devices are never removed, so the result stays valid after we drop
+ * knowndevs_lock.
  */
 static
 int
@@ -482,6 +515,7 @@ findmount(const char *devname, struct knowndev **result)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
@@ -496,6 +530,8 @@ findmount(const char *devname, struct knowndev **result)
 		}
 	}
 
+	rwlock_release_read(knowndevs_lock);
+
 	return found ? 0 : ENODEV;
 }
 
@@ -537,7 +573,9 @@ vfs_mount(const char *devname, void *data,
 
 	KASSERT(fs != NULL);
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	rwlock_release_write(knowndevs_lock);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -584,7 +622,9 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -605,6 +645,10 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
+	/*
+	 * Holding vfs_biglock keeps the list from changing; we can't
+	 * hold knowndevs_lock for reading here as we change kd_fs.
+	 */
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
@@ -647,7 +691,9 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_lock);
 		dev->kd_fs = NULL;
+		rwlock_release_write(knowndevs_lock);
 	}
 
 	vfs_biglock_release();
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -74,6 +75,18 @@ vnode_cleanup(struct vnode *vn)
 }
 
 
+/*
+ * The refcount is changed with atomic operations, not under the
+ * biglock. This is safe because there are only two ways to get a new
+ * reference: from one you already hold, in which case the count
+ * can't be dropping to zero underneath you; or by finding the vnode
+ * in some filesystem's table of loaded vnodes, which is done under
+ * the biglock. Only the last reference needs the biglock: VOP_RECLAIM
+ * takes it, and checks again that the count is still 1 in case the
+ * vnode was just found in a table. If not, it drops the reference we
+ * gave it and returns EBUSY.
+ */
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
@@ -81,13 +94,13 @@ vnode_cleanup(struct vnode *vn)
 void
 vnode_incref(struct vnode *vn)
 {
-	KASSERT(vn != NULL);
+	int count;
 
-	vfs_biglock_acquire();
-
-	vn->vn_refcount++;
+	KASSERT(vn != NULL);
 
-	vfs_biglock_release();
+	count = atomic_inc(&vn->vn_refcount);
+	KASSERT(count > 1);
+	(void)count;
 }
 
 /*
@@ -98,25 +111,29 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	int result;
+	int count, result;
 
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
+	/* Drop a reference that isn't the last one without locking. */
+	while (1) {
+		count = atomic_get(&vn->vn_refcount);
+		KASSERT(count > 0);
+		if (count == 1) {
+			break;
+		}
+		if (atomic_cas(&vn->vn_refcount, count, count - 1) == count) {
+			return;
 		}
 	}
 
+	vfs_biglock_acquire();
+	result = VOP_RECLAIM(vn);
+	if (result != 0 && result != EBUSY) {
+		// XXX: lame.
+		kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+			strerror(result));
+	}
 	vfs_biglock_release();
 }
 
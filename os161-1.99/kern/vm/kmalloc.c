@@ -28,9 +28,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <cpu.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <current.h>
 #include <vm.h>
+#include <kmem_cache.h>
+#include <platform/maxcpus.h>
+#include "opt-kmallocprof.h"
 
 /*
  * Kernel malloc.
@@ -103,7 +110,9 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref **prevp_samesize;
 	struct pageref *next_all;
+	struct pageref **prevp_all;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -117,85 +126,192 @@ struct pageref {
 
 ////////////////////////////////////////
 
+static struct pageref *sizebases[NSIZES];
+static struct pageref *allbase;
+
+////////////////////////////////////////
+
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
+ * Use one spinlock for the whole thing. This covers the pagerefs and
+ * the page freelists, and also the magazine depot (see below); the
+ * per-cpu magazines in front of it are what keep most kmalloc and
+ * kfree calls from ever touching it.
+ */
+
+static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////
+
+/*
+ * Pageref storage.
  *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs are carved out of whole pages obtained with alloc_kpages
+ * as needed, so the amount of heap we can manage grows with the
+ * amount of memory rather than being fixed. Free pagerefs are kept on
+ * a list threaded through next_all. Pages of pagerefs are never given
+ * back; they're a small fraction of the pages they describe.
  */
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+#define PAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *freepagerefs;
+static unsigned npagerefs;		/* total, free or not */
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
+	struct pageref *pr;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
-	}
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	if (pr != NULL) {
+		freepagerefs = pr->next_all;
+		pr->next_all = NULL;
+	}
+	return pr;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	p->pageaddr_and_blocktype = 0;
+	p->next_samesize = NULL;
+	p->prevp_samesize = NULL;
+	p->prevp_all = NULL;
+	p->next_all = freepagerefs;
+	freepagerefs = p;
 }
 
-////////////////////////////////////////
+/*
+ * Get another page of pagerefs. Call without kmalloc_spinlock, since
+ * alloc_kpages might need to come back to kmalloc.
+ */
+static
+int
+pageref_morecore(void)
+{
+	struct pageref *prs;
+	vaddr_t page;
+	unsigned i;
 
-static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return ENOMEM;
+	}
+	prs = (struct pageref *)page;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<PAGEREFS_PER_PAGE; i++) {
+		freepageref(&prs[i]);
+	}
+	npagerefs += PAGEREFS_PER_PAGE;
+	spinlock_release(&kmalloc_spinlock);
+
+	return 0;
+}
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Page table for finding pagerefs.
+ *
+ * To get from a block address to its pageref in constant time we
+ * index by physical page number through a two-level table. The first
+ * level is static and covers all of KSEG0 (512M); each second-level
+ * table is one page of pointers covering 4M of physical memory and is
+ * allocated the first time a subpage page in that range is set up.
+ * Second-level tables are never freed, so once a lookup has found
+ * one it stays valid.
+ *
+ * Entries are written only under kmalloc_spinlock, but kfree reads
+ * them without it. That's safe: the entry for a page is set before
+ * any block on the page is handed out, and not cleared until every
+ * block on it has come back, so the entry for a block being freed
+ * cannot change under us. Pages without an entry are whole-page
+ * allocations.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+#define PT_L2ENTRIES	(PAGE_SIZE / sizeof(struct pageref *))
+#define PT_L2SPAN	(PT_L2ENTRIES * PAGE_SIZE)
+#define PT_L1ENTRIES	((MIPS_KSEG1 - MIPS_KSEG0) / PT_L2SPAN)
+
+#define PT_L1INDEX(kva)	(((kva) - MIPS_KSEG0) / PT_L2SPAN)
+#define PT_L2INDEX(kva)	((((kva) - MIPS_KSEG0) / PAGE_SIZE) % PT_L2ENTRIES)
+
+static struct pageref **pagetable[PT_L1ENTRIES];
+
+/*
+ * Make sure the second-level table covering PAGE exists. Call without
+ * kmalloc_spinlock.
+ */
+static
+int
+pagetable_prepare(vaddr_t page)
+{
+	struct pageref **l2;
+	unsigned i;
+
+	KASSERT(page >= MIPS_KSEG0 && page < MIPS_KSEG1);
+
+	if (pagetable[PT_L1INDEX(page)] != NULL) {
+		return 0;
+	}
+
+	l2 = (struct pageref **)alloc_kpages(1);
+	if (l2 == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<PT_L2ENTRIES; i++) {
+		l2[i] = NULL;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	if (pagetable[PT_L1INDEX(page)] == NULL) {
+		pagetable[PT_L1INDEX(page)] = l2;
+		l2 = NULL;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	if (l2 != NULL) {
+		/* Someone else got there first. */
+		free_kpages((vaddr_t)l2);
+	}
+	return 0;
+}
+
+static
+void
+pagetable_set(vaddr_t page, struct pageref *pr)
+{
+	struct pageref **l2;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(page % PAGE_SIZE == 0);
+
+	l2 = pagetable[PT_L1INDEX(page)];
+	KASSERT(l2 != NULL);
+	l2[PT_L2INDEX(page)] = pr;
+}
+
+static
+struct pageref *
+pagetable_get(vaddr_t addr)
+{
+	struct pageref **l2;
+
+	KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+
+	l2 = pagetable[PT_L1INDEX(addr)];
+	if (l2 == NULL) {
+		return NULL;
+	}
+	return l2[PT_L2INDEX(addr)];
+}
 
 ////////////////////////////////////////
 
@@ -217,6 +333,7 @@ checksubpage(struct pageref *pr)
 	int nfree=0;
 
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pagetable_get(PR_PAGEADDR(pr)) == pr);
 
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		KASSERT(pr->nfree==0);
@@ -260,14 +377,14 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < npagerefs);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(ac < npagerefs);
 		ac++;
 	}
 
@@ -330,6 +447,8 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+static void kmag_printstats(void);
+
 void
 kheap_printstats(void)
 {
@@ -344,33 +463,52 @@ kheap_printstats(void)
 		dumpsubpage(pr);
 	}
 
+	kmag_printstats();
+
 	spinlock_release(&kmalloc_spinlock);
+
+	kmem_cache_printstats();
 }
 
 ////////////////////////////////////////
 
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+add_lists(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
+	KASSERT(blktype>=0 && blktype<NSIZES);
+
+	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prevp_samesize = &pr->next_samesize;
+	}
+	pr->prevp_samesize = &sizebases[blktype];
+	sizebases[blktype] = pr;
 
+	pr->next_all = allbase;
+	if (pr->next_all != NULL) {
+		pr->next_all->prevp_all = &pr->next_all;
+	}
+	pr->prevp_all = &allbase;
+	allbase = pr;
+}
+
+static
+void
+remove_lists(struct pageref *pr, int blktype)
+{
 	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(*pr->prevp_samesize == pr);
+	KASSERT(*pr->prevp_all == pr);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	*pr->prevp_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prevp_samesize = pr->prevp_samesize;
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+	*pr->prevp_all = pr->next_all;
+	if (pr->next_all != NULL) {
+		pr->next_all->prevp_all = pr->prevp_all;
 	}
 }
 
@@ -466,15 +604,23 @@ subpage_kmalloc(size_t sz)
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
 		return NULL;
 	}
+	if (pagetable_prepare(prpage)) {
+		free_kpages(prpage);
+		kprintf("kmalloc: Subpage allocator couldn't get page table\n");
+		return NULL;
+	}
 	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+	while ((pr = allocpageref()) == NULL) {
+		/* Need more accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		if (pageref_morecore()) {
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get "
+				"pageref\n");
+			return NULL;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
@@ -498,16 +644,34 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	add_lists(pr, blktype);
+	pagetable_set(prpage, pr);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Find the block type of the subpage block PTR. Returns -1 if PTR is
+ * not on any of our pages, that is, if it is a whole-page allocation.
+ * This doesn't need the lock; see the notes on the page table above.
+ */
+static
+int
+subpage_blocktype(void *ptr)
+{
+	struct pageref *pr;
+	int blktype;
+
+	pr = pagetable_get((vaddr_t)ptr);
+	if (pr == NULL) {
+		return -1;
+	}
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	return blktype;
+}
+
 static
 int
 subpage_kfree(void *ptr)
@@ -522,28 +686,23 @@ subpage_kfree(void *ptr)
 
 	ptraddr = (vaddr_t)ptr;
 
+	pr = pagetable_get(ptraddr);
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE);
+	checksubpage(pr);
 
 	offset = ptraddr - prpage;
 
@@ -577,6 +736,7 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		pagetable_set(prpage, NULL);
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
@@ -598,9 +758,637 @@ subpage_kfree(void *ptr)
 //
 ////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazine layer.
+//
+// This sits in front of the subpage allocator, after the magazine
+// scheme of Bonwick and Adams. It works like this:
+//
+//    A magazine is a small LIFO stack of free blocks of one size
+//    class. Each cpu has two magazines per size class, the loaded one
+//    and the previous one. kmalloc pops from the loaded magazine and
+//    kfree pushes onto it; when the loaded magazine runs dry (or
+//    fills up) we swap it with the previous one, which is then
+//    guaranteed to be full (or empty) enough to satisfy the next
+//    request too. Only when both are unusable do we go to the depot,
+//    which holds whole magazines, full and empty, for each size class.
+//    The depot is protected by kmalloc_spinlock; the per-cpu
+//    magazines are touched only by their own cpu with interrupts off
+//    and need no lock at all.
+//
+//    Blocks sitting in magazines are allocated as far as the pages
+//    underneath are concerned. To keep that from pinning too much
+//    memory we cap the number of full magazines the depot will hold
+//    and use smaller magazines for the larger size classes. Extra full
+//    magazines are drained back to their pages, and so is the whole
+//    depot if we ever run out of pages.
+//
+//    The magazine structures themselves come straight from the
+//    subpage allocator, bypassing this layer, so there's no recursion.
+//
+
+#define KMAG_ROUNDS	14	/* sizeof(struct kmag) == 64 */
+#define KMAG_DEPOTMAX	4	/* max full magazines in depot per size */
+
+struct kmag {
+	struct kmag *km_next;		/* link on depot lists */
+	unsigned km_count;		/* number of rounds loaded */
+	void *km_rounds[KMAG_ROUNDS];	/* the blocks */
+};
+
+/* Magazine capacity for each size class. */
+static const unsigned kmag_capacity[NSIZES] = {
+	14, 14, 14, 14, 8, 4, 2, 1
+};
+
+struct kmag_cpu {
+	struct kmag *kc_loaded[NSIZES];
+	struct kmag *kc_previous[NSIZES];
+	unsigned kc_hits[NSIZES];	/* requests served by magazines */
+	unsigned kc_misses[NSIZES];	/* requests passed through */
+};
+
+struct kmag_depot {
+	struct kmag *kd_full;
+	struct kmag *kd_empty;
+	unsigned kd_nfull;
+	unsigned kd_nempty;
+};
+
+/* Per-cpu magazines; indexed by c_number, accessed only by that cpu. */
+static struct kmag_cpu kmag_cpus[MAXCPUS];
+
+/* The depot, protected by kmalloc_spinlock. */
+static struct kmag_depot kmag_depot[NSIZES];
+
+static
+struct kmag *
+kmag_pop(struct kmag **list, unsigned *count)
+{
+	struct kmag *m;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	m = *list;
+	if (m != NULL) {
+		*list = m->km_next;
+		m->km_next = NULL;
+		KASSERT(*count > 0);
+		(*count)--;
+	}
+	return m;
+}
+
+static
+void
+kmag_push(struct kmag **list, unsigned *count, struct kmag *m)
+{
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	m->km_next = *list;
+	*list = m;
+	(*count)++;
+}
+
+/*
+ * Return all the blocks in a magazine to the subpage allocator.
+ * Call without kmalloc_spinlock.
+ */
+static
+void
+kmag_drain(struct kmag *m)
+{
+	int result;
+
+	while (m->km_count > 0) {
+		result = subpage_kfree(m->km_rounds[--m->km_count]);
+		KASSERT(result == 0);
+	}
+}
+
+/*
+ * Empty the depot's full magazines back into the subpage allocator
+ * and free all the magazines it holds. Used when we run out of pages.
+ */
+static
+void
+kmag_reap(void)
+{
+	struct kmag_depot *kd;
+	struct kmag *m, *list;
+	unsigned i;
+	int result;
+
+	for (i=0; i<NSIZES; i++) {
+		kd = &kmag_depot[i];
+
+		spinlock_acquire(&kmalloc_spinlock);
+		list = kd->kd_full;
+		kd->kd_full = NULL;
+		kd->kd_nfull = 0;
+		spinlock_release(&kmalloc_spinlock);
+
+		while ((m = list) != NULL) {
+			list = m->km_next;
+			kmag_drain(m);
+			result = subpage_kfree(m);
+			KASSERT(result == 0);
+		}
+
+		spinlock_acquire(&kmalloc_spinlock);
+		list = kd->kd_empty;
+		kd->kd_empty = NULL;
+		kd->kd_nempty = 0;
+		spinlock_release(&kmalloc_spinlock);
+
+		while ((m = list) != NULL) {
+			list = m->km_next;
+			result = subpage_kfree(m);
+			KASSERT(result == 0);
+		}
+	}
+}
+
+/*
+ * Try to get a block of type BLKTYPE from this cpu's magazines,
+ * reloading from the depot if necessary. Returns NULL if there's
+ * nothing cached and the caller should go to the subpage allocator.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *m, *full;
+	void *ret;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	kd = &kmag_depot[blktype];
+
+	/* Interrupts off so we stay on this cpu. */
+	spl = splhigh();
+	kc = &kmag_cpus[curcpu->c_number];
+
+	while (1) {
+		m = kc->kc_loaded[blktype];
+		if (m != NULL && m->km_count > 0) {
+			ret = m->km_rounds[--m->km_count];
+			kc->kc_hits[blktype]++;
+			splx(spl);
+			return ret;
+		}
+
+		m = kc->kc_previous[blktype];
+		if (m != NULL && m->km_count > 0) {
+			kc->kc_previous[blktype] = kc->kc_loaded[blktype];
+			kc->kc_loaded[blktype] = m;
+			continue;
+		}
+
+		/* Both empty (or missing); trade with the depot. */
+		spinlock_acquire(&kmalloc_spinlock);
+		full = kmag_pop(&kd->kd_full, &kd->kd_nfull);
+		if (full == NULL) {
+			spinlock_release(&kmalloc_spinlock);
+			kc->kc_misses[blktype]++;
+			splx(spl);
+			return NULL;
+		}
+		if (m != NULL) {
+			kmag_push(&kd->kd_empty, &kd->kd_nempty, m);
+		}
+		kc->kc_previous[blktype] = kc->kc_loaded[blktype];
+		kc->kc_loaded[blktype] = full;
+		spinlock_release(&kmalloc_spinlock);
+	}
+}
+
+/*
+ * Try to put a block of type BLKTYPE into this cpu's magazines,
+ * exchanging a full magazine for an empty one with the depot if
+ * necessary. Returns false if the caller should give the block back
+ * to the subpage allocator instead.
+ */
+static
+bool
+kmag_free(void *ptr, unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *m, *empty, *excess;
+	unsigned cap;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+
+	kd = &kmag_depot[blktype];
+	cap = kmag_capacity[blktype];
+
+	spl = splhigh();
+	kc = &kmag_cpus[curcpu->c_number];
+
+	while (1) {
+		m = kc->kc_loaded[blktype];
+		if (m != NULL && m->km_count < cap) {
+			m->km_rounds[m->km_count++] = ptr;
+			kc->kc_hits[blktype]++;
+			splx(spl);
+			return true;
+		}
+
+		m = kc->kc_previous[blktype];
+		if (m != NULL && m->km_count < cap) {
+			kc->kc_previous[blktype] = kc->kc_loaded[blktype];
+			kc->kc_loaded[blktype] = m;
+			continue;
+		}
+
+		/* Both full (or missing); trade with the depot. */
+		excess = NULL;
+		spinlock_acquire(&kmalloc_spinlock);
+		empty = kmag_pop(&kd->kd_empty, &kd->kd_nempty);
+		if (empty == NULL) {
+			spinlock_release(&kmalloc_spinlock);
+			splx(spl);
+
+			/*
+			 * Make a new magazine. This may take a page,
+			 * so do it with interrupts back on; then
+			 * donate it to the depot and start over,
+			 * because we might be on another cpu now.
+			 */
+			empty = subpage_kmalloc(sizeof(struct kmag));
+			if (empty == NULL) {
+				return false;
+			}
+			empty->km_next = NULL;
+			empty->km_count = 0;
+
+			spl = splhigh();
+			kc = &kmag_cpus[curcpu->c_number];
+			spinlock_acquire(&kmalloc_spinlock);
+			kmag_push(&kd->kd_empty, &kd->kd_nempty, empty);
+			spinlock_release(&kmalloc_spinlock);
+			continue;
+		}
+		if (m != NULL) {
+			if (kd->kd_nfull < KMAG_DEPOTMAX) {
+				kmag_push(&kd->kd_full, &kd->kd_nfull, m);
+			}
+			else {
+				excess = m;
+			}
+		}
+		kc->kc_previous[blktype] = kc->kc_loaded[blktype];
+		kc->kc_loaded[blktype] = empty;
+		spinlock_release(&kmalloc_spinlock);
+
+		if (excess != NULL) {
+			/*
+			 * The depot has enough full magazines already;
+			 * give these blocks back to their pages.
+			 */
+			kmag_drain(excess);
+			spinlock_acquire(&kmalloc_spinlock);
+			kmag_push(&kd->kd_empty, &kd->kd_nempty, excess);
+			spinlock_release(&kmalloc_spinlock);
+		}
+	}
+}
+
+/*
+ * Print magazine layer stats. Called from kheap_printstats with
+ * kmalloc_spinlock held. The per-cpu counts are read without
+ * stopping the other cpus, so they're only approximate.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmag_cpu *kc;
+	struct kmag *m;
+	unsigned i, j, cached, hits, misses;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	kprintf("Magazine layer status:\n");
+	for (i=0; i<NSIZES; i++) {
+		cached = hits = misses = 0;
+		for (j=0; j<MAXCPUS; j++) {
+			kc = &kmag_cpus[j];
+			if (kc->kc_loaded[i] != NULL) {
+				cached += kc->kc_loaded[i]->km_count;
+			}
+			if (kc->kc_previous[i] != NULL) {
+				cached += kc->kc_previous[i]->km_count;
+			}
+			hits += kc->kc_hits[i];
+			misses += kc->kc_misses[i];
+		}
+		for (m = kmag_depot[i].kd_full; m != NULL; m = m->km_next) {
+			cached += m->km_count;
+		}
+		kprintf("size %-4lu  %u cached, depot %u full %u empty, "
+			"%u hits %u misses\n",
+			(unsigned long) sizes[i], cached,
+			kmag_depot[i].kd_nfull, kmag_depot[i].kd_nempty,
+			hits, misses);
+	}
+}
+
+//
+////////////////////////////////////////////////////////////
+
+#if OPT_KMALLOCPROF
+////////////////////////////////////////////////////////////
+//
+// Allocation profiler.
+//
+// Counts allocations by call site (the return address of kmalloc's
+// caller) and by size class, including live objects and their
+// high-water marks. Sites go in a fixed-size hash table; if it fills
+// up, further sites are lumped together in an overflow entry.
+//
+// To charge a free to the site that made the allocation we keep a
+// second table mapping live block addresses to sites. If that one
+// fills up, the blocks we couldn't record are counted as untracked
+// and their frees are charged to their size class only.
+//
+// Note that allocations made through wrappers such as kstrdup and
+// kmem_cache_alloc are charged to the wrapper.
+//
+
+#define KMPROF_NSITES	128	/* must be a power of 2 */
+#define KMPROF_NLIVE	2048	/* must be a power of 2 */
+#define KMPROF_PAGES	NSIZES	/* class index for whole-page allocs */
+
+struct kmprof_site {
+	vaddr_t ks_site;		/* caller's address, 0 if unused */
+	unsigned ks_allocs;		/* number of allocations */
+	unsigned long ks_bytes;		/* bytes requested */
+	unsigned ks_live;		/* currently allocated */
+	unsigned ks_peak;		/* max of ks_live */
+};
+
+struct kmprof_class {
+	unsigned kc_allocs;
+	unsigned kc_frees;
+	unsigned long kc_bytes;		/* bytes requested */
+	unsigned kc_live;
+	unsigned kc_peak;
+};
+
+struct kmprof_live {
+	vaddr_t kl_addr;		/* block address, 0 if unused */
+	unsigned kl_site;		/* index into kmprof_sites */
+};
+
+/* The extra entry at the end is the overflow bucket. */
+static struct kmprof_site kmprof_sites[KMPROF_NSITES+1];
+static struct kmprof_class kmprof_classes[NSIZES+1];
+static struct kmprof_live kmprof_live[KMPROF_NLIVE];
+static unsigned kmprof_untracked;
+static struct spinlock kmprof_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+kmprof_hash(vaddr_t addr, unsigned size)
+{
+	/* Fibonacci hashing; the low bits of addresses are boring. */
+	return ((uint32_t)addr * 2654435761U) >> 7 & (size - 1);
+}
+
+static
+unsigned
+kmprof_findsite(vaddr_t site)
+{
+	unsigned i, n;
+
+	i = kmprof_hash(site, KMPROF_NSITES);
+	for (n=0; n<KMPROF_NSITES; n++) {
+		if (kmprof_sites[i].ks_site == site) {
+			return i;
+		}
+		if (kmprof_sites[i].ks_site == 0) {
+			kmprof_sites[i].ks_site = site;
+			return i;
+		}
+		i = (i+1) % KMPROF_NSITES;
+	}
+
+	/* Table full; use the overflow bucket. */
+	return KMPROF_NSITES;
+}
+
+static
+void
+kmprof_alloc(void *ptr, size_t sz, unsigned class, vaddr_t site)
+{
+	struct kmprof_site *ks;
+	struct kmprof_class *kc;
+	unsigned i, n, si;
+
+	spinlock_acquire(&kmprof_lock);
+
+	si = kmprof_findsite(site);
+	ks = &kmprof_sites[si];
+	ks->ks_allocs++;
+	ks->ks_bytes += sz;
+
+	kc = &kmprof_classes[class];
+	kc->kc_allocs++;
+	kc->kc_bytes += sz;
+	kc->kc_live++;
+	if (kc->kc_live > kc->kc_peak) {
+		kc->kc_peak = kc->kc_live;
+	}
+
+	i = kmprof_hash((vaddr_t)ptr, KMPROF_NLIVE);
+	for (n=0; n<KMPROF_NLIVE; n++) {
+		if (kmprof_live[i].kl_addr == 0) {
+			kmprof_live[i].kl_addr = (vaddr_t)ptr;
+			kmprof_live[i].kl_site = si;
+			ks->ks_live++;
+			if (ks->ks_live > ks->ks_peak) {
+				ks->ks_peak = ks->ks_live;
+			}
+			break;
+		}
+		i = (i+1) % KMPROF_NLIVE;
+	}
+	if (n == KMPROF_NLIVE) {
+		kmprof_untracked++;
+	}
+
+	spinlock_release(&kmprof_lock);
+}
+
+static
+void
+kmprof_free(void *ptr, unsigned class)
+{
+	struct kmprof_class *kc;
+	unsigned i, j, n, home;
+
+	spinlock_acquire(&kmprof_lock);
+
+	kc = &kmprof_classes[class];
+	kc->kc_frees++;
+	if (kc->kc_live > 0) {
+		/* (might not be if the counters were reset) */
+		kc->kc_live--;
+	}
+
+	i = kmprof_hash((vaddr_t)ptr, KMPROF_NLIVE);
+	for (n=0; n<KMPROF_NLIVE; n++) {
+		if (kmprof_live[i].kl_addr == 0) {
+			/* not tracked */
+			break;
+		}
+		if (kmprof_live[i].kl_addr == (vaddr_t)ptr) {
+			break;
+		}
+		i = (i+1) % KMPROF_NLIVE;
+	}
+	if (n == KMPROF_NLIVE || kmprof_live[i].kl_addr == 0) {
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+
+	if (kmprof_sites[kmprof_live[i].kl_site].ks_live > 0) {
+		kmprof_sites[kmprof_live[i].kl_site].ks_live--;
+	}
+
+	/*
+	 * Remove the entry, shifting later entries of the same probe
+	 * run back so lookups don't stop short at the hole.
+	 */
+	kmprof_live[i].kl_addr = 0;
+	j = i;
+	while (1) {
+		j = (j+1) % KMPROF_NLIVE;
+		if (kmprof_live[j].kl_addr == 0) {
+			break;
+		}
+		home = kmprof_hash(kmprof_live[j].kl_addr, KMPROF_NLIVE);
+		/* Move it if its home slot isn't cyclically in (i, j]. */
+		if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+			kmprof_live[i] = kmprof_live[j];
+			kmprof_live[j].kl_addr = 0;
+			i = j;
+		}
+	}
+
+	spinlock_release(&kmprof_lock);
+}
+
+void
+kheap_printprof(unsigned maxsites)
+{
+	static bool printed[KMPROF_NSITES+1];
+	struct kmprof_site *ks;
+	struct kmprof_class *kc;
+	unsigned i, n, best;
+
+	spinlock_acquire(&kmprof_lock);
+
+	kprintf("kmalloc profile by size class:\n");
+	kprintf("%6s %8s %8s %10s %6s %6s\n", "size", "allocs", "frees",
+		"bytes", "live", "peak");
+	for (i=0; i<=NSIZES; i++) {
+		kc = &kmprof_classes[i];
+		if (i < NSIZES) {
+			kprintf("%6lu ", (unsigned long) sizes[i]);
+		}
+		else {
+			kprintf("%6s ", "pages");
+		}
+		kprintf("%8u %8u %10lu %6u %6u\n", kc->kc_allocs, kc->kc_frees,
+			kc->kc_bytes, kc->kc_live, kc->kc_peak);
+	}
+
+	kprintf("Top %u call sites by allocations:\n", maxsites);
+	kprintf("%10s %8s %10s %6s %6s\n", "site", "allocs", "bytes",
+		"live", "peak");
+	for (i=0; i<=KMPROF_NSITES; i++) {
+		printed[i] = false;
+	}
+	for (n=0; n<maxsites; n++) {
+		best = KMPROF_NSITES+1;
+		for (i=0; i<=KMPROF_NSITES; i++) {
+			ks = &kmprof_sites[i];
+			if (printed[i] || ks->ks_allocs == 0) {
+				continue;
+			}
+			if (best > KMPROF_NSITES ||
+			    ks->ks_allocs > kmprof_sites[best].ks_allocs) {
+				best = i;
+			}
+		}
+		if (best > KMPROF_NSITES) {
+			break;
+		}
+		printed[best] = true;
+		ks = &kmprof_sites[best];
+		if (best == KMPROF_NSITES) {
+			kprintf("%10s ", "(other)");
+		}
+		else {
+			kprintf("0x%08lx ", (unsigned long) ks->ks_site);
+		}
+		kprintf("%8u %10lu %6u %6u\n", ks->ks_allocs,
+			ks->ks_bytes, ks->ks_live, ks->ks_peak);
+	}
+	if (kmprof_untracked > 0) {
+		kprintf("(%u allocations not tracked to their frees)\n",
+			kmprof_untracked);
+	}
+
+	spinlock_release(&kmprof_lock);
+}
+
+/*
+ * Reset the counters. Blocks that are live now stay in the live table
+ * so their frees are still charged correctly; the live counts are
+ * kept for the same reason.
+ */
+void
+kheap_resetprof(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&kmprof_lock);
+	for (i=0; i<=KMPROF_NSITES; i++) {
+		kmprof_sites[i].ks_allocs = 0;
+		kmprof_sites[i].ks_bytes = 0;
+		kmprof_sites[i].ks_peak = kmprof_sites[i].ks_live;
+	}
+	for (i=0; i<=NSIZES; i++) {
+		kmprof_classes[i].kc_allocs = 0;
+		kmprof_classes[i].kc_frees = 0;
+		kmprof_classes[i].kc_bytes = 0;
+		kmprof_classes[i].kc_peak = kmprof_classes[i].kc_live;
+	}
+	kmprof_untracked = 0;
+	spinlock_release(&kmprof_lock);
+}
+
+#endif /* OPT_KMALLOCPROF */
+
 void *
 kmalloc(size_t sz)
 {
+	unsigned blktype;
+	void *ptr;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -612,23 +1400,67 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
+#if OPT_KMALLOCPROF
+		kmprof_alloc((void *)address, sz, KMPROF_PAGES,
+			     (vaddr_t)__builtin_return_address(0));
+#endif
 		return (void *)address;
 	}
 
-	return subpage_kmalloc(sz);
+	blktype = blocktype(sz);
+	ptr = kmag_alloc(blktype);
+	if (ptr == NULL) {
+		ptr = subpage_kmalloc(sz);
+	}
+	if (ptr == NULL) {
+		/* Out of pages; flush the depot and try once more. */
+		kmag_reap();
+		ptr = subpage_kmalloc(sz);
+	}
+#if OPT_KMALLOCPROF
+	if (ptr != NULL) {
+		kmprof_alloc(ptr, sz, blktype,
+			     (vaddr_t)__builtin_return_address(0));
+	}
+#endif
+	return ptr;
 }
 
 void
 kfree(void *ptr)
 {
+	int blktype;
+	int result;
+
+	if (ptr == NULL) {
+		return;
+	}
+
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
-	if (ptr == NULL) {
-		return;
-	} else if (subpage_kfree(ptr)) {
+	blktype = subpage_blocktype(ptr);
+	if (blktype < 0) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#if OPT_KMALLOCPROF
+		kmprof_free(ptr, KMPROF_PAGES);
+#endif
 		free_kpages((vaddr_t)ptr);
+		return;
+	}
+
+	if ((vaddr_t)ptr % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+	fill_deadbeef(ptr, sizes[blktype]);
+#if OPT_KMALLOCPROF
+	kmprof_free(ptr, blktype);
+#endif
+
+	if (kmag_free(ptr, blktype)) {
+		return;
 	}
+	result = subpage_kfree(ptr);
+	KASSERT(result == 0);
 }
 
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmem_cache.h>
+
+/*
+ * Object caches. See kmem_cache.h.
+ *
+ * Each cache keeps a small stack of free constructed objects; beyond
+ * that, objects are destroyed and given back to kmalloc (whose
+ * per-cpu magazines take care of the raw memory). Caches put
+ * themselves on the list of all caches the first time they're used,
+ * so that static caches don't need any explicit setup.
+ */
+
+static struct kmem_cache *allcaches;
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+kmem_cache_register(struct kmem_cache *kc)
+{
+	spinlock_acquire(&allcaches_lock);
+	if (!kc->kc_registered) {
+		kc->kc_next = allcaches;
+		allcaches = kc;
+		kc->kc_registered = true;
+	}
+	spinlock_release(&allcaches_lock);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+	int result;
+
+	if (!kc->kc_registered) {
+		kmem_cache_register(kc);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_allocs++;
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_free[--kc->kc_nfree];
+		goto done;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* Nothing on hand; make a new one. */
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL) {
+		result = kc->kc_ctor(obj);
+		if (result) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_constructs++;
+ done:
+	kc->kc_inuse++;
+	if (kc->kc_inuse > kc->kc_peak) {
+		kc->kc_peak = kc->kc_inuse;
+	}
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_inuse > 0);
+	kc->kc_inuse--;
+	if (kc->kc_nfree < KMEM_CACHE_DEPTH) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* Cache is full; really get rid of it. */
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&allcaches_lock);
+
+	kprintf("Object cache status:\n");
+	kprintf("%-16s %5s %6s %6s %6s %8s %8s\n", "name", "size",
+		"inuse", "peak", "free", "allocs", "ctors");
+	for (kc = allcaches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("%-16s %5lu %6u %6u %6u %8u %8u\n", kc->kc_name,
+			(unsigned long) kc->kc_size, kc->kc_inuse,
+			kc->kc_peak, kc->kc_nfree, kc->kc_allocs,
+			kc->kc_constructs);
+		spinlock_release(&kc->kc_lock);
+	}
+
+	spinlock_release(&allcaches_lock);
+}
@@ -42,6 +42,7 @@
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* after kern/time.h */
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -153,15 +154,35 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
+/* Scheduling. The mask has one bit per cpu number. */
+int setaffinity(unsigned mask);
+int getaffinity(unsigned *mask);
+int settickets(int tickets);
+int getrusage(int who, struct rusage *usage);
+
+/*
+ * Threads. STACK is the top of the new thread's stack. _exit and
+ * execv end the other threads; one that's blocked in the kernel in
+ * anything but thread_join, futex, nanosleep, or a console read holds
+ * them up until it wakes on its own.
+ */
+int __thread_create(void (*start)(void *), void *arg, void *stack);
+__DEAD void thread_exit(int status);
+int thread_join(int tid, int *status);
+int futex(volatile int *addr, int op, int val);	/* ops in <kern/futex.h> */
+
 /*
  * These are not themselves system calls, but wrapper routines in libc.
  */
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int thread_create(int (*func)(void *), void *arg,
+		  void *stack, size_t stacksize); /* calls __thread_create */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include <mutex.h>
+#include <kern/futex.h>
+
+/*
+ * Mutexes and condition variables; see <mutex.h>.
+ *
+ * The mutex is the usual three-state futex lock: 0 is free, 1 is held
+ * with nobody waiting, and 2 is held with (maybe) someone waiting.
+ * Only a thread that finds it 2 on unlock needs to call FUTEX_WAKE,
+ * and only a thread that finds it held calls FUTEX_WAIT.
+ *
+ * A cond is a sequence number. Waiters note it before letting go of
+ * the mutex and sleep only if it hasn't changed, so a signal between
+ * the unlock and the FUTEX_WAIT isn't lost.
+ */
+
+/* More threads than there could ever be, for FUTEX_WAKE */
+#define FUTEX_ALL  0x7fffffff
+
+/* Atomically: if *P is OLD, set it to NEW. Returns what *P was. */
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %0;"		/*   y = x */
+			"bne %0, %3, 1f;"	/*   if (x != old) skip */
+			"nop;"
+			"move %1, %4;"		/*   y = new */
+			"1: sc %1, 0(%2);"	/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Atomically set *P to NEW. Returns what *P was. */
+static
+int
+atomic_swap(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Atomically add one to *P. */
+static
+void
+atomic_inc(volatile int *p)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addiu %1, %0, 1;"	/*   y = x + 1 */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p)
+			: "memory");
+	} while (y == 0);
+}
+
+void
+mutex_init(struct mutex *m)
+{
+	m->m_state = 0;
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+	return atomic_cas(&m->m_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	int state;
+
+	state = atomic_cas(&m->m_state, 0, 1);
+	if (state == 0) {
+		return;
+	}
+
+	/*
+	 * Held. Mark it contended and sleep until it's free; since we
+	 * can't tell whether anyone else is still waiting, we have to
+	 * take it as contended too.
+	 */
+	if (state != 2) {
+		state = atomic_swap(&m->m_state, 2);
+	}
+	while (state != 0) {
+		futex(&m->m_state, FUTEX_WAIT, 2);
+		state = atomic_swap(&m->m_state, 2);
+	}
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if (atomic_swap(&m->m_state, 0) == 2) {
+		futex(&m->m_state, FUTEX_WAKE, 1);
+	}
+}
+
+void
+cond_init(struct cond *c)
+{
+	c->c_seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq = c->c_seq;
+	int state;
+
+	mutex_unlock(m);
+	futex(&c->c_seq, FUTEX_WAIT, seq);
+
+	/* Others may have been woken with us; take it as contended. */
+	state = atomic_swap(&m->m_state, 2);
+	while (state != 0) {
+		futex(&m->m_state, FUTEX_WAIT, 2);
+		state = atomic_swap(&m->m_state, 2);
+	}
+}
+
+void
+cond_signal(struct cond *c)
+{
+	atomic_inc(&c->c_seq);
+	futex(&c->c_seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	atomic_inc(&c->c_seq);
+	futex(&c->c_seq, FUTEX_WAKE, FUTEX_ALL);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Create a thread that runs FUNC(ARG) on the given stack and exits
+ * with FUNC's return value. Uses the system call __thread_create(),
+ * which starts the thread at a function of our choosing; we start it
+ * in thread_trampoline with what it needs stashed at the top of its
+ * stack.
+ */
+
+struct thread_start {
+	int (*ts_func)(void *);
+	void *ts_arg;
+};
+
+/*
+ * Under the MIPS calling convention the 16 bytes above a function's
+ * incoming sp belong to it, for saving its argument registers, so
+ * the thread's sp has to be that far below the thread_start.
+ */
+#define ARGSAVE 16
+
+static
+void
+thread_trampoline(void *data)
+{
+	struct thread_start *ts = data;
+
+	thread_exit(ts->ts_func(ts->ts_arg));
+}
+
+int
+thread_create(int (*func)(void *), void *arg, void *stack, size_t stacksize)
+{
+	struct thread_start *ts;
+	char *top;
+
+	/* Room for the thread_start, the save area, and alignment */
+	if (stack == NULL || stacksize < sizeof(*ts) + ARGSAVE + 8) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Stash func and arg at the (8-byte aligned) top of the stack */
+	top = (char *)(((unsigned long)stack + stacksize) & ~7UL);
+	ts = (struct thread_start *)(top - sizeof(*ts));
+	ts->ts_func = func;
+	ts->ts_arg = arg;
+
+	return __thread_create(thread_trampoline, ts, (char *)ts - ARGSAVE);
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * mutextest.c
+ *
+ * Test the libc mutexes and condition variables under contention.
+ *
+ * First several threads each bump a shared counter many times with a
+ * mutex held, checking nobody else is ever inside at the same time.
+ * Some of them sleep with the mutex held now and then so the others
+ * have to wait for it in the kernel. Then producers and consumers
+ * pass numbers through a small buffer with condition variables, and
+ * we check that every number arrives exactly once.
+ *
+ * Needs user-level threads, futex, and nanosleep.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <mutex.h>
+#include <err.h>
+
+#define NTHREADS   4
+#define STACKSIZE  16384
+
+#define NBUMPS     2000		/* per thread */
+#define NAPEVERY   100		/* sleep holding the mutex this often */
+
+#define NITEMS     500		/* per producer */
+#define BUFSIZE    4
+
+static char stacks[NTHREADS][STACKSIZE];
+
+static
+void
+nap(void)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000000;
+	if (nanosleep(&ts, NULL) < 0) {
+		err(1, "nanosleep");
+	}
+}
+
+static
+void
+startall(int (*func)(void *), int *tids)
+{
+	unsigned long i;
+
+	for (i=0; i<NTHREADS; i++) {
+		tids[i] = thread_create(func, (void *)i, stacks[i], STACKSIZE);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+}
+
+static
+void
+joinall(const int *tids)
+{
+	int i, status;
+
+	for (i=0; i<NTHREADS; i++) {
+		if (thread_join(tids[i], &status) < 0) {
+			err(1, "thread_join");
+		}
+		if (status != 0) {
+			errx(1, "thread %d failed", i);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// mutual exclusion
+
+static struct mutex bumplock = MUTEX_INITIALIZER;
+static volatile int inside;
+static volatile unsigned long counter;
+
+static
+int
+bumper(void *arg)
+{
+	unsigned long me = (unsigned long)arg;
+	unsigned long val;
+	int i;
+
+	for (i=0; i<NBUMPS; i++) {
+		mutex_lock(&bumplock);
+		if (inside) {
+			errx(1, "bumper %lu: mutex held twice", me);
+		}
+		inside = 1;
+		val = counter;
+		if (i % NAPEVERY == (int)me) {
+			/* make the others wait in the kernel */
+			nap();
+		}
+		counter = val + 1;
+		inside = 0;
+		mutex_unlock(&bumplock);
+	}
+	return 0;
+}
+
+static
+void
+test_mutex(void)
+{
+	int tids[NTHREADS];
+
+	startall(bumper, tids);
+	joinall(tids);
+
+	printf("mutex: counter %lu\n", counter);
+	if (counter != (unsigned long)NTHREADS * NBUMPS) {
+		errx(1, "mutex: expected %lu", (unsigned long)NTHREADS * NBUMPS);
+	}
+
+	/* trylock must fail while the mutex is held */
+	mutex_lock(&bumplock);
+	if (mutex_trylock(&bumplock) == 0) {
+		errx(1, "mutex: trylock got a held mutex");
+	}
+	mutex_unlock(&bumplock);
+	if (mutex_trylock(&bumplock) != 0) {
+		errx(1, "mutex: trylock failed on a free mutex");
+	}
+	mutex_unlock(&bumplock);
+}
+
+////////////////////////////////////////////////////////////
+// condition variables: half the threads produce, half consume
+
+static struct mutex buflock = MUTEX_INITIALIZER;
+static struct cond notfull = COND_INITIALIZER;
+static struct cond notempty = COND_INITIALIZER;
+static unsigned buf[BUFSIZE];
+static unsigned bufhead, buftail, bufcount;
+static unsigned consumed;
+static unsigned char seen[NTHREADS / 2 * NITEMS];
+
+static
+int
+producer(void *arg)
+{
+	unsigned long me = (unsigned long)arg;
+	unsigned i;
+
+	for (i=0; i<NITEMS; i++) {
+		mutex_lock(&buflock);
+		while (bufcount == BUFSIZE) {
+			cond_wait(&notfull, &buflock);
+		}
+		buf[bufhead] = me / 2 * NITEMS + i;
+		bufhead = (bufhead + 1) % BUFSIZE;
+		bufcount++;
+		cond_signal(&notempty);
+		mutex_unlock(&buflock);
+	}
+	return 0;
+}
+
+static
+int
+consumer(void *arg)
+{
+	unsigned val;
+
+	(void)arg;
+
+	mutex_lock(&buflock);
+	while (1) {
+		while (bufcount == 0 && consumed < sizeof(seen)) {
+			cond_wait(&notempty, &buflock);
+		}
+		if (bufcount == 0) {
+			/* everything has been taken */
+			break;
+		}
+		val = buf[buftail];
+		buftail = (buftail + 1) % BUFSIZE;
+		bufcount--;
+		if (seen[val]) {
+			errx(1, "cond: got %u twice", val);
+		}
+		seen[val] = 1;
+		if (++consumed == sizeof(seen)) {
+			/* wake the other consumers so they can quit */
+			cond_broadcast(&notempty);
+		}
+		cond_signal(&notfull);
+	}
+	mutex_unlock(&buflock);
+	return 0;
+}
+
+/* Even-numbered threads produce, odd-numbered ones consume */
+static
+int
+prodcons(void *arg)
+{
+	if ((unsigned long)arg % 2 == 0) {
+		return producer(arg);
+	}
+	return consumer(arg);
+}
+
+static
+void
+test_cond(void)
+{
+	int tids[NTHREADS];
+	unsigned i;
+
+	startall(prodcons, tids);
+	joinall(tids);
+
+	printf("cond: %u items passed\n", consumed);
+	for (i=0; i<sizeof(seen); i++) {
+		if (!seen[i]) {
+			errx(1, "cond: item %u never arrived", i);
+		}
+	}
+}
+
+int
+main(void)
+{
+	test_mutex();
+	test_cond();
+	printf("mutextest: passed\n");
+	return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * rusage.c
+ *
+ * Test getrusage: burn some cpu, sleep a few times in this thread and
+ * in another one, and check that the counters went up by at least as
+ * much as they should have. Also check the error cases.
+ *
+ * Needs user-level threads and nanosleep as well as getrusage.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define SPINSECS   1		/* cpu to burn, in seconds */
+#define NSLEEPS    10		/* naps per thread */
+#define NAPNSECS   20000000	/* 20 ms */
+#define STACKSIZE  16384
+
+static char stack[STACKSIZE];
+
+/* Time in microseconds, from a struct timeval or from __time */
+static
+long long
+tv_usecs(const struct timeval *tv)
+{
+	return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static
+long long
+now_usecs(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (long long)secs * 1000000 + nsecs / 1000;
+}
+
+static
+void
+get(struct rusage *ru)
+{
+	if (getrusage(RUSAGE_SELF, ru) < 0) {
+		err(1, "getrusage");
+	}
+}
+
+static
+void
+nap(void)
+{
+	struct timespec ts;
+	int i;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = NAPNSECS;
+	for (i=0; i<NSLEEPS; i++) {
+		if (nanosleep(&ts, NULL) < 0) {
+			err(1, "nanosleep");
+		}
+	}
+}
+
+static
+int
+napper(void *arg)
+{
+	(void)arg;
+	nap();
+	return 0;
+}
+
+/*
+ * Burn cpu: the time should show up in ru_utime, give or take a
+ * tick at each end.
+ */
+static
+void
+test_spin(void)
+{
+	struct rusage before, after;
+	long long start, used;
+	volatile unsigned long n = 0;
+
+	get(&before);
+	start = now_usecs();
+	while (now_usecs() - start < SPINSECS * 1000000LL) {
+		n++;
+	}
+	get(&after);
+
+	used = tv_usecs(&after.ru_utime) - tv_usecs(&before.ru_utime);
+	printf("spin: %lld us of cpu for %d s of spinning\n", used, SPINSECS);
+	if (used < SPINSECS * 1000000LL / 2) {
+		errx(1, "spin: ru_utime went up by only %lld us", used);
+	}
+	if (after.ru_nivcsw < before.ru_nivcsw) {
+		errx(1, "spin: ru_nivcsw went backwards");
+	}
+}
+
+/*
+ * Sleep NSLEEPS times here and NSLEEPS times in another thread. Each
+ * nap is at least one voluntary switch, and the sleep time of the
+ * joined thread must still be counted.
+ */
+static
+void
+test_sleep(void)
+{
+	struct rusage before, after;
+	long long slept, want;
+	unsigned long switches;
+	int tid, status;
+
+	get(&before);
+	tid = thread_create(napper, NULL, stack, STACKSIZE);
+	if (tid < 0) {
+		err(1, "thread_create");
+	}
+	nap();
+	if (thread_join(tid, &status) < 0) {
+		err(1, "thread_join");
+	}
+	get(&after);
+
+	switches = after.ru_nvcsw - before.ru_nvcsw;
+	slept = tv_usecs(&after.ru_sleeptime) - tv_usecs(&before.ru_sleeptime);
+	want = 2LL * NSLEEPS * (NAPNSECS / 1000);
+	printf("sleep: %lu voluntary switches, %lld us asleep, "
+	       "%lu migrations\n", switches, slept,
+	       (unsigned long)after.ru_nmigrations);
+	if (switches < 2 * NSLEEPS) {
+		errx(1, "sleep: expected at least %d voluntary switches",
+		     2 * NSLEEPS);
+	}
+	if (slept < want / 2) {
+		errx(1, "sleep: expected about %lld us asleep", want);
+	}
+	if (after.ru_nmigrations < before.ru_nmigrations) {
+		errx(1, "sleep: ru_nmigrations went backwards");
+	}
+}
+
+static
+void
+test_errors(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_CHILDREN, &ru) != -1 || errno != EINVAL) {
+		errx(1, "RUSAGE_CHILDREN: expected EINVAL");
+	}
+	if (getrusage(RUSAGE_SELF, NULL) != -1 || errno != EFAULT) {
+		errx(1, "NULL rusage: expected EFAULT");
+	}
+	printf("errors: ok\n");
+}
+
+int
+main(void)
+{
+	test_spin();
+	test_sleep();
+	test_errors();
+	printf("rusage: passed\n");
+	return 0;
+}